@@ -7,7 +7,45 @@
  *           Traveling from city i to city j is the ij entry.
  * Output:   The best tour found by the program and the cost
  *           of the tour.
- * Usage:    pth_tsp_search_nr <number of threads> <matrix_file>
+ * Usage:    pth_tsp_search_nr [-e <engine>] [-b <bound>] [-w <work>]
+ *              [-p <seconds>] [-H <dir>] [-N <nodes>] [-E <seconds>]
+ *              [-i <spins>] [-C] [-r] [-l] [-P] [-B] [-u <delta file>]
+ *              [-a <edit file> [-R]] <number of threads> <matrix_file>
+ *           pth_tsp_search_nr [-C] [-M <port>] -d <number of threads>
+ *              <socket>
+ *           number of threads is 0 for one per CPU available
+ *           engine is auto (default), dfs, anneal, aco, hk, portfolio
+ *              or perm
+ *           bound is none (default) or minedge
+ *           work is donate (default) or pool
+ *           -p reports the DFS's progress on stderr every <seconds>
+ *           -H keeps Held-Karp's layers in files in <dir>
+ *           -N stops each solve after about <nodes> DFS nodes
+ *           -E fits the DFS threads to the CPUs available, checking
+ *              every <seconds>
+ *           -i has idle DFS threads spin up to <spins> times before
+ *              sleeping; 0 sleeps at once
+ *           -C cuts the number of threads down to the CPUs available
+ *           -r picks the DFS's root city, rather than city 0
+ *           -l renumbers the cities so that cheap edges join nearby
+ *              numbers
+ *           -P reports hardware counters for each DFS thread on stderr
+ *           -B reads any number of matrices from matrix_file and solves
+ *              each of them
+ *           -u re-solves after each refresh of the costs in <delta file>
+ *           -a adds and drops cities as listed in <edit file> (- for
+ *              stdin), repairing the tour after each; with -R an exact
+ *              re-solve runs in the background until the next edit
+ *           -d serves solve requests on the Unix socket <socket>,
+ *              until SIGTERM or SIGINT
+ *           -M serves the daemon's metrics on http://127.0.0.1:<port>/
+ *              metrics
+ *           SIGINT stops the running solve and reports its best tour;
+ *              a second SIGINT ends the program.  -B doesn't catch
+ *              SIGINT, and -d finishes its queues and exits on it.
+ *           SIGUSR1 prints a snapshot of the running solve on stderr
+ * Compile:  gcc -g -Wall -o pth_tsp_search_nr pth_tsp_search_nr_part2.c
+ *              -lpthread -lm
  *
  * Notes:
  * 1.  Weights and cities are non-negative ints.
@@ -23,16 +61,336 @@
  * 	   tours amongst the threads.
  * 7.  When any thread is finished with work, other threads will 'donate'
  * 	   work to that thread to keep the work distribution even
+ * 8.  The anneal engine is a heuristic for instances too large for the
+ * 	   exact search:  each thread runs a simulated annealing chain at its
+ * 	   own temperature using Or-opt moves (a segment of up to
+ * 	   ANNEAL_MAX_SEG cities is moved elsewhere in the tour without being
+ * 	   reversed, so asymmetric costs are handled exactly).  After every
+ * 	   sweep, chains at neighbouring temperatures may exchange tours.
+ * 9.  The aco engine is a MAX-MIN ant system:  each thread builds
+ * 	   tours for its share of the ants, choosing among the ACO_CAND
+ * 	   cheapest successors of each city, and polishes its best ant with
+ * 	   an Or-opt local search.  The pheromone matrix is laid out like
+ * 	   mat.  Threads evaporate its rows in parallel and thread 0 then
+ * 	   deposits along the best tour of the iteration, or every
+ * 	   ACO_GLOBAL_FREQ iterations along best_tour.
+ * 10. The hk engine is the Held-Karp dynamic program, computed one
+ * 	   subset size at a time with the subsets of each size shared
+ * 	   among the threads.  Only two sizes are kept at once, indexed by
+ * 	   the combinatorial number system, with a byte per entry to
+ * 	   recover the tour.  In memory this allows n <= HK_MAX_N.  With
+ * 	   -H <dir> the layers are memory-mapped files in dir, allowing
+ * 	   n <= HK_MAX_OOC_N given enough disk (about 20 GB for the
+ * 	   largest layer and 33 GB of parent records at n = 32).
+ * 	   The inner minimum is taken by a min-plus kernel chosen at run
+ * 	   time:  AVX-512 or AVX2 gathers from a transposed copy of mat
+ * 	   where the CPU has them, scalar code otherwise or if compiled
+ * 	   with -DHK_SCALAR.
+ * 11. The portfolio engine races the DFS, the anneal engine and, for
+ * 	   n <= HK_MAX_N, Held-Karp, splitting the threads among them.
+ * 	   With fewer threads than engines, the anneal engine and then
+ * 	   Held-Karp sit out, so the DFS always runs.  All of them share
+ * 	   best_tour, and the DFS threads reread its cost every
+ * 	   INCUMBENT_POLL nodes so that heuristic tours tighten their
+ * 	   pruning.  The first exact engine to finish stops the others.
+ * 12. With -b minedge the DFS also prunes on the cheapest edge out of
+ * 	   every city the partial tour has not yet left.
+ * 13. The auto engine measures the instance (Extract_features) and
+ * 	   picks the engine, bound and number of threads from a cost model
+ * 	   whose AUTO_* constants were fitted to tsp_bench.sh.  It seeds
+ * 	   best_tour with the heuristic tour it builds, and logs its
+ * 	   decision on stderr.  A bound given with -b, or a thread count
+ * 	   other than 0, is kept, and the log says so if auto would have
+ * 	   picked another.  Otherwise the thread count is an upper limit.
+ * 	   Daemon jobs have no way to leave the bound unset, so for them
+ * 	   auto picks both.
+ * 14. Progress is estimated from the size of the search tree:  Knuth's
+ * 	   random probes give the number of nodes at each depth, and once a
+ * 	   depth has been expanded PROGRESS_MIN_SAMPLES times by the DFS its
+ * 	   observed branching factor (from search_stats) is used instead.
+ * 15. With -w pool the DFS threads don't start from a static share of
+ * 	   the tree.  Instead every feasible partial tour of pool_depth + 1
+ * 	   cities is listed in a flat array up front, pool_depth being
+ * 	   sized from Knuth estimates of the pruned tree (note 14), and a
+ * 	   thread whose stack is empty claims the next one with an atomic
+ * 	   fetch-and-add.  Only when the array is used up do idle threads
+ * 	   wait in Terminated, so stacks are split only for the last few
+ * 	   prefixes still running.
+ * 16. The perm engine is for tiny instances, n <= PERM_MAX_N, and is
+ * 	   what auto runs for them without measuring the instance.  It
+ * 	   enumerates the tours by swapping cities into place in a single
+ * 	   array, keeping the cost and min-edge bound of every prefix, so
+ * 	   that no tours or stack entries are ever allocated.  It runs on
+ * 	   the main thread.
+ * 17. Batch mode (-B) is for streams of small instances, n <=
+ * 	   BATCH_MAX_N.  Consecutive instances of the same size are grouped
+ * 	   BATCH_LANES at a time, and each group is solved by one thread
+ * 	   running the Held-Karp recurrence over bitmask subsets in
+ * 	   lockstep:  every dp entry and cost is stored as BATCH_LANES
+ * 	   adjacent values, one per instance, so a step of the recurrence
+ * 	   is one vector add, compare and min for the whole group.  A short
+ * 	   group is padded with copies of its last instance.  The vector
+ * 	   width is chosen at run time as in note 10.
+ * 18. A delta file (-u) holds any number of refreshes, each a count
+ * 	   followed by that many "i j cost" lines.  After each one is
+ * 	   applied (Apply_delta) the previous best tour, re-costed, is the
+ * 	   incumbent for the next Solve with the same engine, bound and
+ * 	   threads.  min_out and nbr_lists are only recomputed for the rows
+ * 	   that changed.
+ * 19. An edit file (-a) holds any number of edits, each either
+ * 	   "drop <city>" or "add" followed by the n costs from the existing
+ * 	   cities to the new one and the n costs from it to them.  Cities
+ * 	   above a dropped one are renumbered down, and an added one is
+ * 	   city n.  mat is kept at stride n inside a buffer with room for
+ * 	   mat_capacity cities, so that adding a city only moves its rows
+ * 	   up in place.  The tour is repaired at once by cheapest insertion
+ * 	   or by joining the dropped city's neighbours, then Or-opt.  If
+ * 	   the solve left no whole tour, as a stopped one can, a nearest
+ * 	   neighbour tour is repaired instead (Complete_best_tour).
+ * 20. With -d the program is a daemon.  A client connects to the
+ * 	   socket and sends any number of jobs, each the ints n, engine
+ * 	   (engine_t), bound (bound_t), priority, CPU budget in ms (0 for
+ * 	   none) and an id of the client's choosing, followed by the n * n
+ * 	   costs, all in the host's byte order.  For each job it gets back
+ * 	   the ints cost, count, status (job_status_t), lower bound (note
+ * 	   22), the job's id and the count cities of the tour.  Replies
+ * 	   come in the order the jobs finished, which preemption (note 21)
+ * 	   can make differ from the order they were sent, so the client
+ * 	   matches them up by id.  SIGTERM or SIGINT shuts the daemon down
+ * 	   once its queues are empty (Quit_handler); a client can't.
+ * 	   A client sending anything invalid, or whose unanswered jobs'
+ * 	   costs would pass DAEMON_MAX_PENDING_BYTES or can't be
+ * 	   allocated, is dropped once its queued jobs are answered.  Room
+ * 	   for a job's costs is reserved from its header, before they
+ * 	   arrive, and the jobs of all clients may reserve at most
+ * 	   DAEMON_MAX_QUEUED_BYTES:  past that, readers wait for jobs to
+ * 	   be answered (Reserve_costs), which bounds the daemon's memory
+ * 	   whatever the clients send.  A client that reserves room and
+ * 	   then goes COSTS_TIMEOUT_MS without sending any costs is
+ * 	   dropped, so that it can't hold the room.  A client that doesn't
+ * 	   take a reply within REPLY_TIMEOUT_MS is dropped at once, so
+ * 	   that it can't hold up the other clients.  Jobs from all clients
+ * 	   are queued and run one at a time by worker_count threads
+ * 	   started once:  in this mode Start_threads hands work to them
+ * 	   rather than creating threads.  See tsp_client.c.
+ * 21. Daemon jobs have a priority from 0 (most urgent) to
+ * 	   JOB_PRIORITIES - 1, and run first by priority, then in order of
+ * 	   arrival.  A job arriving with a more urgent priority than the
+ * 	   running one preempts it (Park_search):  the DFS threads put
+ * 	   their stacks, and any unclaimed donated stack, on parked_stack
+ * 	   instead of freeing them, and the job is saved with its instance
+ * 	   and put back at the head of its priority.  On resuming, the
+ * 	   parked stacks are dealt round-robin to the DFS threads, and an
+ * 	   unfinished prefix pool carries on where it stopped, so no work
+ * 	   is lost.  Held-Karp and the heuristics keep only best_tour and
+ * 	   start over.  A job's CPU time, over all its runs, is checked
+ * 	   every BUDGET_POLL_MS by Watch_budgets, which stops the job when
+ * 	   it is over budget and replies with the best tour so far.
+ * 22. A solve can be stopped early, by a node budget (-N), by SIGINT,
+ * 	   or by a daemon job's CPU budget.  SIGINT only sets
+ * 	   cancel_requested; the DFS threads look at it and at the node
+ * 	   count every INCUMBENT_POLL nodes, and the other engines once
+ * 	   per round, in Stop_requested, which calls Finish_search.  Each
+ * 	   Solve clears cancel_requested, so that the -u or -a re-solves
+ * 	   after a stopped one run in full.  A second SIGINT kills the
+ * 	   program.  A stopped solve still reports
+ * 	   its best tour, and solve_lower_bound:  the cheapest bound over
+ * 	   the DFS's unexpanded frontier (each node's cost plus the
+ * 	   cheapest exit from its last city and from every unvisited
+ * 	   one), or just that sum for the root if no DFS ran.  A solve
+ * 	   by the heuristics alone reports that bound too, though it ran
+ * 	   its course:  only an exact engine finishing (solve_proved)
+ * 	   makes best_tour's cost the bound.
+ * 23. The DFS threads running can change during a solve (-E):  a
+ * 	   Resizer thread sets dfs_target from the CPUs the process may
+ * 	   use, and threads of rank dfs_target and up leave in Terminated
+ * 	   (Bench), handing their stacks over as a donated new_stack and
+ * 	   sleeping on bench_cond until they are wanted again or the solve
+ * 	   ends.  The termination test counts dfs_active, the threads not
+ * 	   benched, so the last of them to run out of work, or the last to
+ * 	   leave, ends the search.  Rank 0 never leaves.
+ * 24. A DFS thread out of work spins on new_stack, for at most its
+ * 	   spin_limit iterations, before sleeping on term_cond_var, since
+ * 	   a wake-up takes tens of microseconds.  spin_limit doubles, up
+ * 	   to idle_spins, when spinning got the work, and halves, down to
+ * 	   SPIN_MIN, when the thread had to sleep.  By default idle_spins
+ * 	   is SPIN_MAX, or 0 on a single CPU, where a spinner only delays
+ * 	   the donor.  The time from donation to claim is recorded for
+ * 	   each mode and reported with -p.
+ * 25. The CPUs available (Available_cpus) are those in the affinity
+ * 	   mask, capped by the CPU quota of the process's cgroup (v2
+ * 	   cpu.max or v1 cpu.cfs_quota_us), rounded up.  More threads than
+ * 	   that get a warning when a DFS runs, since a donor preempted
+ * 	   while it holds term_mutex stalls every idle thread; -C uses the
+ * 	   CPU count instead.  Batch mode, the daemon and the engines
+ * 	   other than the DFS don't share work, so they aren't warned.
+ * 26. Any city can be the start of a cyclic tour, and the one the DFS
+ * 	   starts from changes the size of its tree a great deal.  With -r
+ * 	   Choose_root estimates the tree below each possible root with
+ * 	   Knuth probes, pruned against a nearest neighbour tour, and the
+ * 	   cheapest is swapped with city 0 in mat.  city_labels maps the
+ * 	   new numbers back, and Print_tour prints the tour in the original
+ * 	   numbering, starting from the original city 0.  -r is ignored
+ * 	   with -B, -u, -a and -d, whose input numbers the cities.
+ * 27. With -l the cities are renumbered (Relabel) in the order of a
+ * 	   nearest neighbour chain from city 0, before any -r, so that a
+ * 	   city's cheap successors are mostly near it in its row of mat
+ * 	   and their rows are near each other.  This is for the
+ * 	   heuristics on large instances, whose moves stay among cheap
+ * 	   edges but would otherwise touch scattered cache lines and
+ * 	   pages.  The same restrictions as -r apply.
+ * 28. With -P each DFS thread opens perf_event_open counters for
+ * 	   itself (perf_names) when it starts and reads them when it
+ * 	   stops, and the solve prints them per thread, per node expanded.
+ * 	   Counters the kernel or the machine doesn't offer are shown as
+ * 	   "-"; only user-space events are counted.
+ * 29. Compiled with -DNO_MAIN the file has no main, so another program
+ * 	   can include it and call its functions directly; tsp_microbench.c
+ * 	   does this to time the DFS's primitives.
+ * 30. With -p and more than one DFS thread, the solve also prints how
+ * 	   each thread spent its time:  splitting its stack for a donation,
+ * 	   idle in Terminated (spinning or in pthread_cond_wait), and
+ * 	   waiting for term_mutex or best_tour_lock when another thread
+ * 	   held it; the rest is busy expanding nodes.  Locks are timed
+ * 	   only when a trylock fails, so the uncontended path costs no
+ * 	   clock reads.  Time on the bench (note 23) isn't counted.  The
+ * 	   imbalance is the busiest thread's busy time over the mean, less 1.
+ * 31. SIGUSR1 prints a snapshot of the solve on stderr without
+ * 	   stopping it:  each DFS thread's nodes expanded, depth and stack
+ * 	   size, and the best tour's cost.  The handler only sets
+ * 	   snapshot_requested; the Monitor thread, which runs for every
+ * 	   solve, prints the snapshot.  Monitor naps on monitor_cond
+ * 	   rather than sleeping, so the end of a solve wakes it at once
+ * 	   and joining it adds nothing to the solve's latency.  The DFS
+ * 	   threads publish their depth and stack size every
+ * 	   INCUMBENT_POLL nodes and when they go idle, so a snapshot can
+ * 	   lag the search by that much.  A SIGUSR1 between solves, as in
+ * 	   the daemon, is answered by the next one.
+ * 32. With -M <port> the daemon serves its metrics over HTTP on
+ * 	   127.0.0.1:<port>, at /metrics, in Prometheus' text format
+ * 	   (Serve_metrics):  jobs answered by engine and status, the
+ * 	   latency from a job's arrival to its reply as a histogram for
+ * 	   each range of n (METRIC_N_BOUNDS), the DFS nodes expanded and
+ * 	   pruned and the CPU seconds used by engine, summed from
+ * 	   search_stats after every run, preemptions, and the jobs queued
+ * 	   at each priority.  Rates such as jobs or nodes per second are
+ * 	   left to Prometheus.  The engine is the one that ran, after auto
+ * 	   has chosen.
  */
+#define _GNU_SOURCE /* For sched_getaffinity */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <pthread.h>
+#if defined(__x86_64__) && !defined(HK_SCALAR)
+#include <immintrin.h>
+#endif
 
+#undef INFINITY /* Ours is the int weight sentinel, not math.h's float */
 const int INFINITY = 1000000;
 const int NO_CITY = -1;
 const int FALSE = 0;
 const int TRUE = 1;
 
+/* Simulated annealing parameters */
+const int ANNEAL_MAX_SEG = 3; /* Longest segment moved by Or-opt */
+const int ANNEAL_SWEEP = 100; /* Moves per city between exchanges */
+const int ANNEAL_ROUNDS = 1000; /* Number of replica exchanges */
+const double ANNEAL_T_HIGH = 0.5; /* Hottest chain, times mean edge cost */
+const double ANNEAL_T_LOW = 0.01; /* Coldest chain, times mean edge cost */
+
+/* Ant colony parameters */
+const int ACO_CAND = 15; /* Length of each city's candidate list */
+const int ACO_ANTS = 24; /* Ants per iteration, shared among threads */
+const int ACO_ITERATIONS = 500;
+const int ACO_GLOBAL_FREQ = 10; /* Deposit along best_tour this often */
+const double ACO_RHO = 0.02; /* Evaporation rate */
+
+#define HK_MAX_OOC_N 32 /* Largest instance for Held-Karp with -H */
+const int HK_MAX_N = 22; /* Largest instance for Held-Karp in memory */
+#define PERM_MAX_N 12 /* Largest instance for the perm engine */
+#define BATCH_LANES 16 /* Instances solved together in batch mode */
+const int MAT_SPARE = 16; /* Room for added cities when mat must grow */
+const int DAEMON_MAX_N = 2000; /* Largest job the daemon accepts, 16 MB */
+const long DAEMON_MAX_PENDING_BYTES = 1L << 26; /* Costs queued per client */
+const long DAEMON_MAX_QUEUED_BYTES = 1L << 28; /* Costs queued in all */
+#define JOB_PRIORITIES 3 /* 0 is the most urgent */
+#define ENGINE_COUNT 7 /* Entries of engine_t */
+#define JOB_STATUSES 3 /* Entries of job_status_t */
+#define METRIC_N_CLASSES 6 /* Latency histograms, by n; note 32 */
+#define METRIC_BUCKETS 7 /* Latency buckets, the last +Inf */
+#define PERF_EVENTS 5 /* Hardware counters for -P */
+const int BUDGET_POLL_MS = 10; /* How often CPU budgets are checked */
+const int METRICS_TIMEOUT_MS = 1000; /* For a scrape to send or take */
+const int REPLY_TIMEOUT_MS = 1000; /* For a client to take a reply */
+const int COSTS_TIMEOUT_MS = 1000; /* Between reads of a job's costs */
+const int BATCH_MAX_N = 16; /* Largest instance in batch mode */
+const unsigned long HK_CHUNK = 4096; /* Subsets claimed at a time */
+const int INCUMBENT_POLL = 1024; /* DFS nodes between best_tour reads */
+const int SPIN_MAX = 20000; /* Default idle spins, with more than one CPU */
+const int SPIN_MIN = 100; /* Adaptive spins never drop below this */
+
+/* Auto engine cost model, fitted to tsp_bench.sh on random gen_mat
+ * matrices.  DFS time is AUTO_DFS_T14 seconds at n = 14, growing by a
+ * factor AUTO_DFS_RATE per city; the exponent is scaled by the
+ * instance's bound gap over AUTO_CAL_GAP, the gap of the calibration
+ * instances.  Held-Karp takes AUTO_HK_NS ns per unit of n^2 2^n. */
+const double AUTO_DFS_T14[] = { 0.16, 0.014 }; /* Indexed by bound_t */
+const double AUTO_DFS_RATE[] = { 3.5, 2.5 };
+const double AUTO_CAL_GAP = 0.9;
+const double AUTO_HK_NS = 0.7;
+const double AUTO_SERIAL_TIME = 0.01; /* Below this, use one thread */
+const double AUTO_EXACT_TIME = 60.0; /* Above this, don't run exact alone */
+const int AUTO_PORTFOLIO_MAX_N = 30; /* Race the DFS up to this n */
+const int AUTO_ACO_MIN_N = 100; /* ACO range, otherwise anneal */
+const int AUTO_ACO_MAX_N = 1000;
+const double AUTO_TRIANGLE_MAX = 0.2; /* ACO needs a good neighbourhood */
+const int AUTO_TRIANGLE_SAMPLES = 10000;
+
+const int POOL_TASKS_PER_THREAD = 32; /* Prefixes per thread, at least */
+
+const int PROGRESS_PROBES = 200; /* Knuth probes per estimate */
+const long PROGRESS_MIN_SAMPLES = 1000; /* Before trusting a depth */
+
+typedef enum {
+	ENGINE_AUTO, ENGINE_DFS, ENGINE_ANNEAL, ENGINE_ACO, ENGINE_HK,
+	ENGINE_PORTFOLIO, ENGINE_PERM
+} engine_t;
+
+typedef enum {
+	BOUND_NONE, BOUND_MIN_EDGE
+} bound_t;
+
+typedef enum {
+	WORK_DONATE, WORK_POOL
+} work_t;
+
+const char* engine_names[] = { "auto", "dfs", "anneal", "aco", "hk",
+		"portfolio", "perm" };
+const char* bound_names[] = { "none", "minedge" };
+const char* status_names[JOB_STATUSES] = { "complete", "over_budget",
+		"stopped" };
+const int METRIC_N_BOUNDS[METRIC_N_CLASSES - 1] = { 10, 20, 50, 100, 1000 };
+const double METRIC_LATENCY_BOUNDS[METRIC_BUCKETS - 1] = { 0.001, 0.01,
+		0.1, 1.0, 10.0, 100.0 };
+const char* perf_names[PERF_EVENTS] = { "cycles", "instructions",
+		"L1d misses", "LLC misses", "branch misses" };
+
+
 typedef int city_t;
 typedef int weight_t;
 
@@ -49,16 +407,143 @@ typedef struct stack_struct {
 	struct stack_struct* next_p; /* Next record on stack */
 } stack_elt_t;
 
+typedef struct {
+	double symmetry; /* Fraction of pairs i < j with equal costs */
+	double spread; /* Coefficient of variation of the edge costs */
+	double triangle; /* Fraction of sampled triples violating it */
+	weight_t lower; /* Min-edge bound on the optimal tour */
+	weight_t upper; /* Cost of the heuristic tour */
+	double gap; /* (upper - lower) / lower */
+} features_t;
+
+typedef struct {
+	city_t from, to;
+	weight_t cost;
+} delta_t;
+
+/* A daemon client.  It is freed when its reader has seen the end of
+ * the stream and none of its jobs are still queued or running. */
+typedef struct {
+	int fd;
+	int pending; /* Jobs not yet answered */
+	long pending_bytes; /* Bytes of their costs */
+	int reading; /* Reader thread still running */
+	pthread_mutex_t lock;
+} conn_t;
+
+typedef enum {
+	JOB_COMPLETE, /* The engine ran to the end */
+	JOB_OVER_BUDGET, /* Stopped by its CPU budget */
+	JOB_STOPPED /* Stopped by the node budget */
+} job_status_t;
+
+/* The state of a parked job:  its instance and its DFS frontier */
+typedef struct {
+	int n, mat_capacity;
+	weight_t* mat;
+	weight_t* min_out;
+	weight_t min_out_total;
+	city_t* nbr_lists;
+	int nbr_count;
+	tour_t best_tour;
+	engine_t engine;
+	bound_t bound;
+	stack_elt_t* parked_stack;
+	int parked_size;
+	city_t* pool_prefixes;
+	int pool_depth;
+	long pool_count, pool_next;
+} instance_t;
+
+typedef struct job_struct {
+	conn_t* conn_p;
+	int n;
+	engine_t engine;
+	bound_t bound;
+	int priority;
+	double budget; /* CPU seconds, 0 for none */
+	double cpu_used; /* In earlier runs, if it was preempted */
+	double arrived; /* Now() when it was read */
+	int id; /* Chosen by the client, and sent back with the reply */
+	weight_t* mat;
+	instance_t* saved; /* Set while parked */
+	struct job_struct* next_p;
+} job_t;
+
+typedef struct {
+	void *(*fn)(void*); /* NULL when the worker is idle */
+	long rank;
+} worker_task_t;
+
+typedef struct {
+	volatile long* nodes; /* nodes[d]:  nodes with d cities expanded */
+	volatile long* prunes; /* prunes[d]:  unvisited nbrs of them pruned */
+	int spin_limit; /* Spins before sleeping when out of work */
+	long handoffs[2]; /* Donated stacks claimed spinning, after sleeping */
+	double handoff_wait[2]; /* Their total latency, in seconds */
+	double handoff_max;
+	double run_time; /* Seconds in Search */
+	double split_time; /* In Split_stack, for donations */
+	double wait_time; /* Idle, waiting for a donated stack */
+	double lock_time; /* Waiting for a contended lock */
+	double bench_time; /* On the bench */
+	volatile int depth; /* Cities in the last tour expanded; see note 31 */
+	volatile int stack_size; /* Records on the thread's stack */
+	int perf_fds[PERF_EVENTS]; /* -1 if the counter couldn't be opened */
+	long long perf_counts[PERF_EVENTS];
+} search_stats_t;
+
 /*------------------------------------------------------------------*/
 
 void Usage(char* prog_name);
 void Read_mat(FILE* mat_file);
+void Start_instance(void);
+void Free_instance(void);
+void Solve(void);
+void Apply_delta(delta_t* deltas, int count);
+void Recost_best_tour(void);
+void Run_refreshes(FILE* delta_file);
+void Add_city(weight_t* to_new, weight_t* from_new);
+void Drop_city(city_t k);
+void Repair_tour(city_t* order);
+void Complete_best_tour(void);
+void *Background_solve(void* arg);
+void Run_edits(FILE* edit_file, int resolve);
+
+void Run_daemon(char* socket_name);
+void Quit_handler(int sig);
+void *Read_jobs(void* arg);
+void *Run_jobs(void* arg);
+void Release_conn(conn_t* conn_p);
+int Reserve_costs(conn_t* conn_p, long bytes);
+void Free_costs(conn_t* conn_p, long bytes);
+void Queue_job(job_t* job_p, int at_head);
+void Save_instance(job_t* job_p);
+void Restore_instance(job_t* job_p);
+void *Watch_budgets(void* arg);
+double Cpu_time(void);
+double Now(void);
+void *Serve_metrics(void* arg);
+void Count_run(double cpu, int parked);
+void Count_reply(job_t* job_p, job_status_t status);
+void Write_metrics(FILE* out);
+int Read_all(int fd, void* buf, size_t bytes);
+int Write_all(int fd, const void* buf, size_t bytes);
+void Compute_min_edges(void);
+city_t Choose_root(void);
+void Relabel_root(city_t root);
+void Relabel(city_t* order);
+void Extract_features(features_t* feat_p, city_t* order);
+void Choose_engine(features_t* feat_p);
 void Print_mat(void);
 void Initialize_tour(tour_t* tour_p);
 
 void *Search(void* rank);
-void Check_best_tour(city_t city, tour_t* tour_p, int *l_best_tour);
-int Feasible(city_t city, city_t nbr, tour_t* tour_p, int l_best_tour);
+void Check_best_tour(city_t city, tour_t* tour_p, int *l_best_tour,
+		search_stats_t* my_stats);
+int Feasible(city_t city, city_t nbr, tour_t* tour_p, weight_t lower,
+		int l_best_tour);
+weight_t Lower_bound(tour_t* tour_p);
 int Visited(city_t nbr, tour_t* tour_p);
 void Print_tour(tour_t* tour_p, char* title);
 void Push(tour_t* tour_p, city_t city, weight_t cost, stack_elt_t** my_stack);
@@ -71,14 +556,128 @@ int Terminated(stack_elt_t** my_stack, volatile int* my_stack_size,
 void Split_stack(stack_elt_t* my_stack, volatile int* my_stack_size,
 		long my_rank);
 void Print_stack(stack_elt_t* stack_p, char* title);
+void Free_stack(stack_elt_t* stack_p);
+void Finish_search(void);
+void Bench(stack_elt_t** my_stack, volatile int* my_stack_size,
+		long my_rank);
+void Set_dfs_target(int target);
+void *Resizer(void* arg);
+int Available_cpus(void);
+int Cgroup_cpus(void);
+int Stop_requested(void);
+void Cancel_handler(int sig);
+void Snapshot_handler(int sig);
+void Print_snapshot(void);
+weight_t Stack_bound(stack_elt_t* stack_p);
+weight_t Pool_bound(void);
+void Park_search(void);
+void Park_stack(stack_elt_t* stack_p, int size);
+void Deal_parked_stack(void);
+void Build_prefix_pool(void);
+void Enumerate_prefixes(city_t* prefix, int count, weight_t cost,
+		int l_best_tour, long* capacity_p);
+int Claim_prefix(stack_elt_t** my_stack, volatile int* my_stack_size);
+void Start_threads(void *(*thread_fn)(void*), int count, pthread_t* handles);
+void Join_threads(int count, pthread_t* handles);
+void *Worker(void* rank);
+double Elapsed(void);
+void Print_handoffs(void);
+void Timed_lock(pthread_mutex_t* mutex_p, search_stats_t* my_stats);
+void Timed_rdlock(pthread_rwlock_t* lock_p, search_stats_t* my_stats);
+void Timed_wrlock(pthread_rwlock_t* lock_p, search_stats_t* my_stats);
+void Print_balance(void);
+void Start_perf(search_stats_t* my_stats);
+void Stop_perf(search_stats_t* my_stats);
+void Print_perf(void);
+double Knuth_probe(city_t* prefix, int count, weight_t cost, int l_best_tour,
+		double* levels, unsigned* seed_p);
+double Estimate_subtree(city_t* prefix, int count, weight_t cost, int probes,
+		double* levels, unsigned* seed_p);
+double Estimate_tree_size(long* done_p, unsigned* seed_p);
+void *Monitor(void* arg);
+void Init_monitor(void);
+void Monitor_nap(long ms);
+
+void Nearest_neighbor_tour(city_t* order);
+weight_t Tour_cost(city_t* order);
+void Update_best_tour(city_t* order, weight_t cost);
+void Setup_anneal(void);
+void Free_anneal(void);
+void *Anneal(void* rank);
+weight_t Or_opt_delta(city_t* order, int i, int j, int k);
+void Or_opt_apply(city_t* order, int i, int j, int k);
+void Exchange_replicas(int round, unsigned* seed_p);
+void Build_nbr_lists(int count);
+void Build_nbr_row(city_t i, city_t* row);
+void Or_opt_local_search(city_t* order, weight_t* cost_p);
+void Setup_aco(void);
+void Free_aco(void);
+void *Ant_colony(void* rank);
+void Construct_ant_tour(city_t* order, char* visited, unsigned* seed_p);
+void Update_pheromone(int iter);
+int Hk_max_n(void);
+void Setup_hk(void);
+void Free_hk(void);
+void *Held_karp(void* rank);
+void Hk_tour(city_t* order, weight_t* cost_p);
+void* Hk_map(size_t bytes);
+unsigned long Hk_rank(unsigned long set);
+unsigned long Hk_unrank(unsigned long rank, int s);
+void Hk_fill(int s, unsigned long first, unsigned long last);
+void Hk_set_scalar(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par);
+#if defined(__x86_64__) && !defined(HK_SCALAR)
+void Hk_set_avx2(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par);
+void Hk_set_avx512(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par);
+#endif
+
+void Perm_search(void);
+
+void Read_batch(FILE* mat_file);
+void Solve_batch(void);
+void *Batch_worker(void* rank);
+void Batch_group(int first, int count, weight_t* dp, unsigned char* par,
+		weight_t* costs);
+void Batch_step_scalar(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par);
+#if defined(__x86_64__) && !defined(HK_SCALAR)
+void Batch_step_avx2(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par);
+void Batch_step_avx512(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par);
+#endif
 
 /*------------------------------------------------------------------*/
 /* Global variables */
 
 int n;
 int thread_count;
+engine_t engine = ENGINE_AUTO;
+bound_t bound = BOUND_NONE;
+int bound_given = FALSE; /* -b was passed:  auto keeps bound */
+int threads_given = FALSE; /* A thread count other than 0:  auto keeps it */
+int warn_threads = FALSE; /* More threads than CPUs:  the first DFS warns */
+
+/* Root choice (note 26):  city i of mat is city city_labels[i] of the
+ * input, or city i itself if city_labels is NULL */
+int root_choice = FALSE;
+int locality_labels = FALSE; /* -l, note 27 */
+city_t* city_labels = NULL;
+const int ROOT_PROBES = 200; /* Knuth probes per candidate root */
+
+/* min_out[i] is the cheapest edge leaving i; min_out_total their sum */
+weight_t* min_out;
+weight_t min_out_total;
+
+/* Threads given to each engine; all of thread_count unless racing */
+int dfs_thread_count = 0;
+int heur_thread_count = 0;
+int hk_thread_count = 0;
 
 weight_t* mat;
+int mat_capacity; /* Cities mat has room for, at least n */
 tour_t best_tour;
 
 pthread_rwlock_t best_tour_lock;
@@ -86,61 +685,891 @@ pthread_cond_t term_cond_var;
 pthread_mutex_t term_mutex;
 
 volatile int threads_in_cond_wait = 0;
+volatile int dfs_active; /* DFS threads not on the bench */
+volatile int dfs_target; /* Ranks below this should be running */
+pthread_cond_t bench_cond; /* dfs_target went up, or the solve ended */
+double elastic_interval = 0.0; /* Seconds between Resizer checks */
+volatile int solve_done = FALSE; /* Some exact engine has finished */
+volatile int solve_complete = FALSE; /* Finished, rather than stopped */
+int solve_proved = FALSE; /* An exact engine finished:  best_tour is optimal */
+volatile int solve_parking = FALSE; /* Stopped to be resumed later */
+
+/* Stopping a solve early; see note 22 */
+volatile sig_atomic_t cancel_requested = FALSE;
+volatile sig_atomic_t snapshot_requested = FALSE; /* Note 31 */
+long node_budget = 0; /* DFS nodes per solve; 0 for no limit */
+volatile long nodes_charged; /* DFS nodes counted against it */
+weight_t frontier_bound; /* Cheapest bound of a frontier freed on a stop */
+weight_t solve_lower_bound; /* Bound on the optimum after a Solve */
+
+/* DFS frontier of a parked solve, and its share for each thread when
+ * it resumes */
+stack_elt_t* parked_stack = NULL;
+int parked_size = 0;
+stack_elt_t** resume_stacks = NULL;
+int* resume_sizes = NULL;
+
+/* Prefix pool:  prefix i is pool_prefixes[(pool_depth + 1) * i + ...] */
+work_t work_mode = WORK_DONATE;
+city_t* pool_prefixes = NULL;
+int pool_depth;
+long pool_count = 0;
+volatile long pool_next = 0;
+
+/* Progress reporting */
+search_stats_t* search_stats; /* One per DFS thread */
+struct timespec solve_start;
+double progress_interval = 0.0; /* Seconds; 0 for no reports */
+volatile double tree_size_estimate = 0.0; /* Latest, in DFS nodes */
+volatile int monitor_stop = FALSE;
+/* Monitor and Resizer nap on monitor_cond, so that setting monitor_stop
+ * under monitor_mutex ends a nap at once */
+pthread_mutex_t monitor_mutex;
+pthread_cond_t monitor_cond;
 
 stack_elt_t *new_stack = NULL;
 volatile int new_stack_size = 0;
+double new_stack_since; /* Elapsed when new_stack was donated */
+int perf_counters = FALSE; /* -P */
+int perf_errno = 0; /* Why the last perf_event_open failed */
+int spin_option = -1; /* -i, or -1 to choose from the CPU count */
+int idle_spins; /* Most spins in Terminated for this solve */
+
+/* Anneal engine: chain i holds anneal_tours[i] at anneal_temps[i] */
+city_t** anneal_tours;
+weight_t* anneal_costs;
+double* anneal_temps;
+pthread_barrier_t anneal_barrier;
+
+/* nbr_lists[nbr_count * i + r] is the r-th cheapest successor of i */
+city_t* nbr_lists = NULL;
+int nbr_count = 0;
+
+/* Ant colony engine */
+double* pher; /* pher[n * i + j] is the pheromone on edge i -> j */
+double tau_min, tau_max;
+city_t** aco_tours; /* Best ant of the current iteration, per thread */
+weight_t* aco_costs;
+pthread_barrier_t aco_barrier;
+
+/* Stop flag for the barrier-synchronized heuristics, set by rank 0 */
+volatile int heur_stop = FALSE;
+
+/* Held-Karp:  layer s holds, for each set S of s cities other than 0
+ * in rank order and each j in S, the cost of the cheapest path from 0
+ * through S ending at j.  Only layers s - 1 and s are kept, in
+ * hk_layer[(s - 1) % 2] and hk_layer[s % 2].  hk_parent[s] holds the
+ * next to last city of each of those paths. */
+char* hk_dir = NULL; /* Directory for out-of-core layers, or NULL */
+unsigned long hk_binom[HK_MAX_OOC_N][HK_MAX_OOC_N];
+weight_t* hk_layer[2];
+size_t hk_layer_bytes[2];
+unsigned char* hk_parent[HK_MAX_OOC_N];
+volatile unsigned long hk_next_chunk;
+volatile int hk_stop = FALSE;
+weight_t* hk_mat_t; /* hk_mat_t[n * j + k] = mat[n * k + j] */
+void (*hk_set)(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par); /* Min-plus kernel for one subset */
+pthread_barrier_t hk_barrier;
+
+/* Batch mode:  the instances read with -B, and the groups they are
+ * solved in.  Group g is instances batch_groups[g] up to, but not
+ * including, batch_groups[g + 1]. */
+int batch_mode = FALSE;
+int batch_count = 0;
+int* batch_sizes;
+weight_t** batch_mats; /* Laid out like mat */
+tour_t* batch_tours;
+int batch_group_count = 0;
+int* batch_groups;
+volatile int batch_next_group = 0;
+void (*batch_step)(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par);
+
+/* Persistent workers, used by Start_threads when worker_count > 0.
+ * Workers worker_next and up are free for the solve being started;
+ * worker_busy of them are still running their task. */
+int worker_count = 0;
+pthread_t* worker_handles;
+worker_task_t* worker_tasks;
+int worker_next = 0;
+int worker_busy = 0;
+int worker_quit = FALSE;
+pthread_mutex_t worker_mutex;
+pthread_cond_t worker_cond; /* A task was given out, or quit */
+pthread_cond_t worker_idle_cond; /* worker_busy reached 0 */
+
+/* Daemon job queues, one per priority, and the job running */
+job_t* job_head[JOB_PRIORITIES], *job_tail[JOB_PRIORITIES];
+job_t* running_job = NULL;
+double running_since; /* Cpu_time when running_job started */
+int budget_stop = FALSE; /* running_job was stopped by its budget */
+int daemon_quit = FALSE;
+int daemon_fd;
+long queued_bytes = 0; /* Costs of the jobs not yet answered */
+pthread_cond_t space_cond; /* queued_bytes went down */
+pthread_mutex_t job_mutex;
+pthread_cond_t job_cond;
+
+/* Daemon metrics (note 32), under metrics_mutex.  metric_latency[c][b]
+ * counts the jobs of n class c whose latency fell in bucket b, not
+ * cumulatively. */
+int metrics_port = 0; /* -M, 0 for no metrics */
+int metrics_fd = -1;
+pthread_mutex_t metrics_mutex;
+long metric_jobs[ENGINE_COUNT][JOB_STATUSES];
+long metric_latency[METRIC_N_CLASSES][METRIC_BUCKETS];
+double metric_latency_sum[METRIC_N_CLASSES];
+long metric_nodes[ENGINE_COUNT], metric_prunes[ENGINE_COUNT];
+double metric_cpu[ENGINE_COUNT];
+long metric_parked = 0;
+long solve_nodes, solve_prunes; /* DFS totals of the last Solve */
 /*------------------------------------------------------------------*/
 
+#ifndef NO_MAIN
 int main(int argc, char* argv[]) {
-	FILE* mat_file;
-	long i;
-	pthread_t* thread_handles;
+	FILE* mat_file, *delta_file, *edit_file;
+	char* delta_name = NULL, *edit_name = NULL;
+	int resolve_edits = FALSE, daemon_mode = FALSE;
+	int clamp_threads = FALSE, cpus, opt;
+	struct sigaction cancel_action, snapshot_action;
 
-	if (argc != 3)
+	while ((opt = getopt(argc, argv, "e:b:w:p:H:N:E:i:CrlPBu:a:RdM:")) != -1) {
+		if (opt == 'd')
+			daemon_mode = TRUE;
+		else if (opt == 'M')
+			metrics_port = strtol(optarg, NULL, 10);
+		else if (opt == 'a')
+			edit_name = optarg;
+		else if (opt == 'R')
+			resolve_edits = TRUE;
+		else if (opt == 'u')
+			delta_name = optarg;
+		else if (opt == 'B')
+			batch_mode = TRUE;
+		else if (opt == 'p')
+			progress_interval = strtod(optarg, NULL);
+		else if (opt == 'H')
+			hk_dir = optarg;
+		else if (opt == 'N')
+			node_budget = strtol(optarg, NULL, 10);
+		else if (opt == 'E')
+			elastic_interval = strtod(optarg, NULL);
+		else if (opt == 'i')
+			spin_option = strtol(optarg, NULL, 10);
+		else if (opt == 'C')
+			clamp_threads = TRUE;
+		else if (opt == 'r')
+			root_choice = TRUE;
+		else if (opt == 'l')
+			locality_labels = TRUE;
+		else if (opt == 'P')
+			perf_counters = TRUE;
+		else if (opt == 'w' && strcmp(optarg, "donate") == 0)
+			work_mode = WORK_DONATE;
+		else if (opt == 'w' && strcmp(optarg, "pool") == 0)
+			work_mode = WORK_POOL;
+		else if (opt == 'e' && strcmp(optarg, "auto") == 0)
+			engine = ENGINE_AUTO;
+		else if (opt == 'b' && strcmp(optarg, "none") == 0)
+			bound = BOUND_NONE, bound_given = TRUE;
+		else if (opt == 'b' && strcmp(optarg, "minedge") == 0)
+			bound = BOUND_MIN_EDGE, bound_given = TRUE;
+		else if (opt == 'e' && strcmp(optarg, "dfs") == 0)
+			engine = ENGINE_DFS;
+		else if (opt == 'e' && strcmp(optarg, "anneal") == 0)
+			engine = ENGINE_ANNEAL;
+		else if (opt == 'e' && strcmp(optarg, "aco") == 0)
+			engine = ENGINE_ACO;
+		else if (opt == 'e' && strcmp(optarg, "hk") == 0)
+			engine = ENGINE_HK;
+		else if (opt == 'e' && strcmp(optarg, "portfolio") == 0)
+			engine = ENGINE_PORTFOLIO;
+		else if (opt == 'e' && strcmp(optarg, "perm") == 0)
+			engine = ENGINE_PERM;
+		else
+			Usage(argv[0]);
+	}
+	if (argc - optind != 2)
 		Usage(argv[0]);
 
-	thread_count = strtol(argv[1], NULL, 10);
-	mat_file = fopen(argv[2], "r");
+	thread_count = strtol(argv[optind], NULL, 10);
+	if (thread_count < 0 || metrics_port < 0 || metrics_port > 65535)
+		Usage(argv[0]);
+	if (batch_mode || delta_name != NULL || edit_name != NULL || daemon_mode)
+		root_choice = locality_labels = FALSE;
+	threads_given = thread_count > 0;
+	cpus = Available_cpus();
+	if (thread_count == 0) {
+		thread_count = cpus;
+	} else if (thread_count > cpus && clamp_threads) {
+		fprintf(stderr, "threads: using %d, the CPUs available, rather "
+				"than %d\n", cpus, thread_count);
+		thread_count = cpus;
+	} else if (thread_count > cpus && !batch_mode && !daemon_mode) {
+		warn_threads = TRUE;
+	}
+	memset(&snapshot_action, 0, sizeof(snapshot_action));
+	snapshot_action.sa_handler = Snapshot_handler;
+	snapshot_action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &snapshot_action, NULL);
+	if (daemon_mode) {
+		Run_daemon(argv[optind + 1]);
+		return 0;
+	}
+	mat_file = fopen(argv[optind + 1], "r");
 
 	if (mat_file == NULL) {
-		fprintf(stderr, "Can't open %s\n", argv[2]);
+		fprintf(stderr, "Can't open %s\n", argv[optind + 1]);
 		Usage(argv[0]);
 	}
+	if (batch_mode) {
+		Read_batch(mat_file);
+		fclose(mat_file);
+		Solve_batch();
+		return 0;
+	}
 	Read_mat(mat_file);
 	fclose(mat_file);
 
-	thread_handles = malloc(thread_count * sizeof(pthread_t));
-
 	pthread_rwlock_init(&best_tour_lock, NULL);
 	pthread_cond_init(&term_cond_var, NULL);
+	pthread_cond_init(&bench_cond, NULL);
 	pthread_mutex_init(&term_mutex, NULL);
+	Init_monitor();
+
+	/* The first SIGINT stops the solve, a second one the program */
+	memset(&cancel_action, 0, sizeof(cancel_action));
+	cancel_action.sa_handler = Cancel_handler;
+	cancel_action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &cancel_action, NULL);
 
 #  ifdef DEBUG2
 	Print_mat();
 	fflush(stdout);
 #  endif
 
-	Initialize_tour(&best_tour);
-	best_tour.cost = INFINITY;
-
-	for (i = 0; i < thread_count; i++)
-		pthread_create(&thread_handles[i], NULL, Search, (void*) i);
-
-	for (i = 0; i < thread_count; i++)
-		pthread_join(thread_handles[i], NULL);
+	Start_instance();
+	Solve();
 
 	Print_tour(&best_tour, "Best tour");
 	printf("Cost = %d\n", best_tour.cost);
+	if (!solve_complete)
+		printf("Stopped early:  lower bound = %d\n", solve_lower_bound);
+	else if (!solve_proved)
+		printf("Not proved optimal:  lower bound = %d\n", solve_lower_bound);
+
+	if (delta_name != NULL) {
+		delta_file = fopen(delta_name, "r");
+		if (delta_file == NULL) {
+			fprintf(stderr, "Can't open %s\n", delta_name);
+			Usage(argv[0]);
+		}
+		Run_refreshes(delta_file);
+		fclose(delta_file);
+	}
+	if (edit_name != NULL) {
+		edit_file = strcmp(edit_name, "-") == 0 ? stdin
+				: fopen(edit_name, "r");
+		if (edit_file == NULL) {
+			fprintf(stderr, "Can't open %s\n", edit_name);
+			Usage(argv[0]);
+		}
+		Run_edits(edit_file, resolve_edits);
+		if (edit_file != stdin)
+			fclose(edit_file);
+	}
 
 	pthread_rwlock_destroy(&best_tour_lock);
 	pthread_cond_destroy(&term_cond_var);
+	pthread_cond_destroy(&bench_cond);
 	pthread_mutex_destroy(&term_mutex);
+	pthread_cond_destroy(&monitor_cond);
+	pthread_mutex_destroy(&monitor_mutex);
 
-	free(thread_handles);
-	free(best_tour.cities);
-	free(mat);
+	Free_instance();
 	return 0;
 } /* main */
+#endif
+
+/*------------------------------------------------------------------
+ * Function:            Start_instance
+ * Purpose:             Prepare a newly read mat for Solve:  compute the
+ *                      min edges, clear best_tour, and resolve the auto
+ *                      engine
+ * Global vars in:      mat, n
+ * Global vars in/out:  engine, bound, thread_count
+ * Global vars out:     min_out, min_out_total, best_tour, nbr_lists
+ */
+void Start_instance(void) {
+	features_t feat;
+	city_t* order;
+
+	if (locality_labels && n > 3) {
+		order = malloc(n * sizeof(city_t));
+		Nearest_neighbor_tour(order);
+		Relabel(order);
+		free(order);
+	}
+	Compute_min_edges();
+	if (root_choice && n > 3)
+		Relabel_root(Choose_root());
+	Initialize_tour(&best_tour);
+	best_tour.cost = INFINITY;
+
+	if (engine == ENGINE_AUTO && n <= PERM_MAX_N)
+		engine = ENGINE_PERM;
+	if (engine == ENGINE_AUTO) {
+		Extract_features(&feat, order = malloc(n * sizeof(city_t)));
+		Update_best_tour(order, feat.upper);
+		free(order);
+		Choose_engine(&feat);
+	}
+} /* Start_instance */
+
+/*------------------------------------------------------------------
+ * Function:         Free_instance
+ * Purpose:          Free what Read_mat and Start_instance allocated
+ * Global vars out:  mat, min_out, nbr_lists, nbr_count, best_tour
+ */
+void Free_instance(void) {
+	free(best_tour.cities);
+	free(min_out);
+	free(nbr_lists);
+	free(mat);
+	free(city_labels);
+	city_labels = NULL;
+	nbr_lists = NULL;
+	nbr_count = 0;
+} /* Free_instance */
+
+/*------------------------------------------------------------------
+ * Function:            Solve
+ * Purpose:             Run the chosen engine, or engines, on mat until
+ *                      they finish or Finish_search is called, starting
+ *                      from the tour already in best_tour.  Can be called
+ *                      again after mat changes.
+ * Global vars in:      n, thread_count, work_mode, progress_interval
+ * Global vars in/out:  engine, best_tour, warn_threads
+ * Global vars out:     dfs_thread_count, heur_thread_count,
+ *                      hk_thread_count, dfs_active, dfs_target,
+ *                      solve_lower_bound, solve_proved,
+ *                      cancel_requested, and the engines' per-solve
+ *                      state
+ */
+void Solve(void) {
+	long i;
+	pthread_t* thread_handles;
+	int started = 0, d;
+	weight_t lower, bound_i;
+	pthread_t monitor_handle, resizer_handle;
+
+	dfs_thread_count = heur_thread_count = hk_thread_count = 0;
+	heur_stop = hk_stop = monitor_stop = FALSE;
+	solve_complete = FALSE;
+	threads_in_cond_wait = 0;
+	new_stack_size = 0;
+	tree_size_estimate = 0.0;
+	nodes_charged = 0;
+	cancel_requested = FALSE; /* A SIGINT stops only the solve it hit */
+	frontier_bound = INFINITY;
+
+	if (engine == ENGINE_PERM && n > PERM_MAX_N)
+		engine = ENGINE_DFS;
+	/* Or-opt needs somewhere other than its own neighbours to move to */
+	if ((engine == ENGINE_ANNEAL || engine == ENGINE_ACO)
+			&& n < ANNEAL_MAX_SEG + 2)
+		engine = ENGINE_DFS;
+	if (engine == ENGINE_HK && n > Hk_max_n())
+		engine = ENGINE_DFS;
+
+	if (engine == ENGINE_PORTFOLIO) {
+		/* The DFS gets the most threads.  With too few for every engine
+		 * to have one, the heuristics are left out first, then
+		 * Held-Karp. */
+		if (n <= Hk_max_n() && thread_count >= 2)
+			hk_thread_count = thread_count / 4 > 0 ? thread_count / 4 : 1;
+		if (n >= ANNEAL_MAX_SEG + 2
+				&& thread_count >= 2 + (hk_thread_count > 0))
+			heur_thread_count = thread_count / 4 > 0 ? thread_count / 4 : 1;
+		dfs_thread_count = thread_count - heur_thread_count - hk_thread_count;
+	} else if (engine == ENGINE_ANNEAL || engine == ENGINE_ACO) {
+		heur_thread_count = thread_count;
+	} else if (engine == ENGINE_HK) {
+		hk_thread_count = thread_count;
+	} else if (engine != ENGINE_PERM) {
+		dfs_thread_count = thread_count;
+	}
+
+	thread_handles = malloc((dfs_thread_count + heur_thread_count
+			+ hk_thread_count) * sizeof(pthread_t));
+	if (warn_threads && dfs_thread_count > 0) {
+		fprintf(stderr, "threads: %d threads on %d CPUs will slow the "
+				"DFS's work sharing; -C uses %d\n", thread_count,
+				Available_cpus(), Available_cpus());
+		warn_threads = FALSE;
+	}
+	idle_spins = spin_option >= 0 ? spin_option
+			: Available_cpus() > 1 ? SPIN_MAX : 0;
+	search_stats = calloc(dfs_thread_count, sizeof(search_stats_t));
+	for (i = 0; i < dfs_thread_count; i++) {
+		search_stats[i].nodes = calloc(n + 1, sizeof(long));
+		search_stats[i].prunes = calloc(n + 1, sizeof(long));
+		search_stats[i].spin_limit = idle_spins;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &solve_start);
+
+	if (engine == ENGINE_PERM) {
+		/* Too quick to poll Stop_requested:  it always runs to the end,
+		 * even if a park or a budget stop came in meanwhile */
+		Perm_search();
+		solve_complete = TRUE;
+	}
+	if (engine == ENGINE_ACO) {
+		Setup_aco();
+		Start_threads(Ant_colony, heur_thread_count, thread_handles);
+	} else if (heur_thread_count > 0) {
+		Setup_anneal();
+		Start_threads(Anneal, heur_thread_count, thread_handles);
+	}
+	started += heur_thread_count;
+	if (hk_thread_count > 0) {
+		Setup_hk();
+		Start_threads(Held_karp, hk_thread_count, thread_handles + started);
+	}
+	started += hk_thread_count;
+	if (work_mode == WORK_POOL && dfs_thread_count > 0
+			&& pool_prefixes == NULL) /* Else resuming a parked pool */
+		Build_prefix_pool();
+	if (parked_stack != NULL && dfs_thread_count > 0)
+		Deal_parked_stack();
+	dfs_active = dfs_target = dfs_thread_count;
+	Start_threads(Search, dfs_thread_count, thread_handles + started);
+	started += dfs_thread_count;
+	pthread_create(&monitor_handle, NULL, Monitor, NULL);
+	if (elastic_interval > 0.0 && dfs_thread_count > 1)
+		pthread_create(&resizer_handle, NULL, Resizer, NULL);
+
+	Join_threads(started, thread_handles);
+	/* Only the exact engines set solve_complete, when they finish */
+	solve_proved = solve_complete;
+	if (!solve_done)
+		solve_complete = TRUE; /* Heuristics that ran their course */
+	if (solve_proved) {
+		solve_lower_bound = best_tour.cost;
+	} else {
+		solve_lower_bound = min_out_total;
+		if (dfs_thread_count > 0) {
+			/* Anything not on the frontier was pruned against best_tour */
+			lower = best_tour.cost;
+			if (frontier_bound < lower)
+				lower = frontier_bound;
+			if ((bound_i = Stack_bound(new_stack)) < lower)
+				lower = bound_i;
+			if ((bound_i = Stack_bound(parked_stack)) < lower)
+				lower = bound_i;
+			if ((bound_i = Pool_bound()) < lower)
+				lower = bound_i;
+			if (lower > solve_lower_bound)
+				solve_lower_bound = lower;
+		}
+		if (solve_lower_bound > best_tour.cost)
+			solve_lower_bound = best_tour.cost;
+	}
+	pthread_mutex_lock(&monitor_mutex);
+	monitor_stop = TRUE;
+	pthread_cond_broadcast(&monitor_cond);
+	pthread_mutex_unlock(&monitor_mutex);
+	pthread_join(monitor_handle, NULL);
+	if (elastic_interval > 0.0 && dfs_thread_count > 1)
+		pthread_join(resizer_handle, NULL);
+	if (progress_interval > 0.0 && dfs_thread_count > 1) {
+		Print_handoffs();
+		Print_balance();
+	}
+	if (perf_counters && dfs_thread_count > 0)
+		Print_perf();
+	solve_nodes = solve_prunes = 0;
+	for (i = 0; i < dfs_thread_count; i++)
+		for (d = 0; d <= n; d++) {
+			solve_nodes += search_stats[i].nodes[d];
+			solve_prunes += search_stats[i].prunes[d];
+		}
+	for (i = 0; i < dfs_thread_count; i++) {
+		free((long*) search_stats[i].nodes);
+		free((long*) search_stats[i].prunes);
+	}
+	free(search_stats);
+
+	if (engine == ENGINE_ACO)
+		Free_aco();
+	else if (heur_thread_count > 0)
+		Free_anneal();
+	if (hk_thread_count > 0)
+		Free_hk();
+	free(resume_stacks);
+	free(resume_sizes);
+	resume_stacks = NULL;
+	resume_sizes = NULL;
+	if (solve_parking && !solve_complete) {
+		Park_stack(new_stack, new_stack_size);
+	} else {
+		Free_stack(new_stack);
+		Free_stack(parked_stack);
+		parked_stack = NULL;
+		parked_size = 0;
+		free(pool_prefixes);
+		pool_prefixes = NULL;
+	}
+	new_stack = NULL;
+	free(thread_handles);
+	/* Only now, so that a Finish_search made before the engines had
+	 * started still stops them */
+	solve_done = FALSE;
+} /* Solve */
+
+/*------------------------------------------------------------------
+ * Function:            Apply_delta
+ * Purpose:             Change count entries of mat, and bring min_out,
+ *                      min_out_total and nbr_lists up to date for the
+ *                      rows that changed.  No engine may be running.
+ * In args:             deltas, count
+ * Global vars in:      n, nbr_count
+ * Global vars in/out:  mat, min_out, min_out_total, nbr_lists
+ */
+void Apply_delta(delta_t* deltas, int count) {
+	char* dirty = calloc(n, sizeof(char));
+	city_t* row = malloc(n * sizeof(city_t));
+	int d, i, j;
+
+	for (d = 0; d < count; d++) {
+		mat[n * deltas[d].from + deltas[d].to] = deltas[d].cost;
+		dirty[deltas[d].from] = TRUE;
+	}
+	for (i = 0; i < n; i++) {
+		if (!dirty[i])
+			continue;
+		min_out_total -= min_out[i];
+		min_out[i] = INFINITY;
+		for (j = 0; j < n; j++)
+			if (j != i && mat[n * i + j] < min_out[i])
+				min_out[i] = mat[n * i + j];
+		min_out_total += min_out[i];
+		if (nbr_lists != NULL)
+			Build_nbr_row(i, row);
+	}
+	free(row);
+	free(dirty);
+} /* Apply_delta */
+
+/*------------------------------------------------------------------
+ * Function:            Recost_best_tour
+ * Purpose:             Make the previous best tour the incumbent under
+ *                      the current costs, whether or not it got dearer
+ * Global vars in:      mat, n
+ * Global vars in/out:  best_tour
+ */
+void Recost_best_tour(void) {
+	int i;
+
+	if (best_tour.count != n + 1)
+		return; /* No complete tour yet */
+	best_tour.cost = 0;
+	for (i = 0; i < n; i++)
+		best_tour.cost += mat[n * best_tour.cities[i] + best_tour.cities[i + 1]];
+} /* Recost_best_tour */
+
+/*------------------------------------------------------------------
+ * Function:   Run_refreshes
+ * Purpose:    Apply each refresh in delta_file and re-solve from the
+ *             previous tour, printing the new tour and, on stderr, how
+ *             long the re-solve took
+ * In arg:     delta_file
+ */
+void Run_refreshes(FILE* delta_file) {
+	delta_t* deltas;
+	int count, d, refresh = 0;
+	weight_t old_cost;
+	char title[64];
+
+	while (fscanf(delta_file, "%d", &count) == 1) {
+		deltas = malloc(count * sizeof(delta_t));
+		for (d = 0; d < count; d++)
+			if (fscanf(delta_file, "%d %d %d", &deltas[d].from, &deltas[d].to,
+					&deltas[d].cost) != 3 || deltas[d].from < 0
+					|| deltas[d].from >= n || deltas[d].to < 0
+					|| deltas[d].to >= n) {
+				fprintf(stderr, "Bad entry %d of refresh %d\n", d, refresh);
+				exit(1);
+			}
+		Apply_delta(deltas, count);
+		free(deltas);
+		Recost_best_tour();
+		old_cost = best_tour.cost;
+
+		Solve();
+		fprintf(stderr, "refresh %d: %d entries, old tour %d, new tour %d, "
+				"%.4f s\n", refresh, count, old_cost, best_tour.cost, Elapsed());
+		sprintf(title, "Best tour after refresh %d", refresh);
+		Print_tour(&best_tour, title);
+		printf("Cost = %d\n", best_tour.cost);
+		refresh++;
+	}
+} /* Run_refreshes */
+
+/*------------------------------------------------------------------
+ * Function:            Add_city
+ * Purpose:             Add city n to the instance and insert it into
+ *                      best_tour where it costs least.  If mat has no
+ *                      room it is reallocated with MAT_SPARE to spare;
+ *                      either way the rows move to stride n + 1 from
+ *                      the last one down, so nothing is overwritten
+ *                      before it has been moved.  No engine may be
+ *                      running.
+ * In args:             to_new:    to_new[i] is the cost from i to city n
+ *                      from_new:  from_new[i] is the cost from city n to i
+ * Global vars in/out:  n, mat, mat_capacity, min_out, min_out_total,
+ *                      nbr_lists, best_tour
+ */
+void Add_city(weight_t* to_new, weight_t* from_new) {
+	int i, j, best_p = 0;
+	city_t c = n;
+	weight_t delta, best_delta = INFINITY;
+	city_t* order = malloc((n + 1) * sizeof(city_t));
+
+	Complete_best_tour();
+	if (mat_capacity < n + 1) {
+		mat_capacity = n + 1 + MAT_SPARE;
+		mat = realloc(mat, mat_capacity * mat_capacity * sizeof(weight_t));
+	}
+	for (i = n - 1; i > 0; i--)
+		for (j = n - 1; j >= 0; j--)
+			mat[(n + 1) * i + j] = mat[n * i + j];
+	for (i = 0; i < n; i++) {
+		mat[(n + 1) * i + c] = to_new[i];
+		mat[(n + 1) * c + i] = from_new[i];
+	}
+	mat[(n + 1) * c + c] = 0;
+
+	/* Cheapest insertion, after order[best_p] */
+	for (i = 0; i < n; i++) {
+		order[i] = best_tour.cities[i];
+		delta = to_new[order[i]] + from_new[best_tour.cities[i + 1]]
+				- mat[(n + 1) * order[i] + best_tour.cities[i + 1]];
+		if (delta < best_delta) {
+			best_delta = delta;
+			best_p = i;
+		}
+	}
+	memmove(order + best_p + 2, order + best_p + 1,
+			(n - 1 - best_p) * sizeof(city_t));
+	order[best_p + 1] = c;
+	n++;
+
+	min_out = realloc(min_out, n * sizeof(weight_t));
+	min_out[c] = INFINITY;
+	for (i = 0; i < c; i++) {
+		if (to_new[i] < min_out[i]) {
+			min_out_total += to_new[i] - min_out[i];
+			min_out[i] = to_new[i];
+		}
+		if (from_new[i] < min_out[c])
+			min_out[c] = from_new[i];
+	}
+	min_out_total += min_out[c];
+	if (nbr_lists != NULL)
+		Build_nbr_lists(ACO_CAND);
+
+	free(best_tour.cities);
+	Initialize_tour(&best_tour);
+	Repair_tour(order);
+	free(order);
+} /* Add_city */
+
+/*------------------------------------------------------------------
+ * Function:            Drop_city
+ * Purpose:             Remove city k (not 0) from the instance and from
+ *                      best_tour, joining its neighbours, and renumber
+ *                      the cities above it.  mat keeps its buffer and
+ *                      moves to stride n - 1 from the first row up.  No
+ *                      engine may be running.
+ * In arg:              k
+ * Global vars in/out:  n, mat, min_out, min_out_total, nbr_lists,
+ *                      best_tour
+ */
+void Drop_city(city_t k) {
+	int i, j, count = 0;
+	char* stale = malloc(n * sizeof(char));
+	city_t* order = malloc(n * sizeof(city_t));
+
+	Complete_best_tour();
+	for (i = 0; i < n; i++) {
+		if (best_tour.cities[i] != k)
+			order[count++] = best_tour.cities[i] - (best_tour.cities[i] > k);
+		/* Rows whose cheapest edge went to k */
+		stale[i] = mat[n * i + k] == min_out[i];
+	}
+	for (i = 0; i < n - 1; i++)
+		for (j = 0; j < n - 1; j++)
+			mat[(n - 1) * i + j] = mat[n * (i + (i >= k)) + j + (j >= k)];
+
+	min_out_total -= min_out[k];
+	for (i = 0; i < n - 1; i++) {
+		min_out[i] = min_out[i + (i >= k)];
+		stale[i] = stale[i + (i >= k)];
+	}
+	n--;
+	for (i = 0; i < n; i++) {
+		if (!stale[i])
+			continue;
+		min_out_total -= min_out[i];
+		min_out[i] = INFINITY;
+		for (j = 0; j < n; j++)
+			if (j != i && mat[n * i + j] < min_out[i])
+				min_out[i] = mat[n * i + j];
+		min_out_total += min_out[i];
+	}
+	if (nbr_lists != NULL)
+		Build_nbr_lists(ACO_CAND);
+
+	free(best_tour.cities);
+	Initialize_tour(&best_tour);
+	Repair_tour(order);
+	free(order);
+	free(stale);
+} /* Drop_city */
+
+/*------------------------------------------------------------------
+ * Function:         Repair_tour
+ * Purpose:          Polish a tour of the current cities with Or-opt
+ *                   and make it best_tour, whatever its cost.  A cost
+ *                   of INFINITY or more means the tour takes a missing
+ *                   edge; it is kept, so that later edits have a tour
+ *                   to repair, but reported on stderr.
+ * In/out arg:       order:  the n cities in the order they are visited
+ * Global vars in:   n
+ * Global vars out:  best_tour, nbr_lists if it was not built
+ */
+void Repair_tour(city_t* order) {
+	weight_t cost = Tour_cost(order);
+
+	if (n >= ANNEAL_MAX_SEG + 2) {
+		if (nbr_lists == NULL)
+			Build_nbr_lists(ACO_CAND);
+		Or_opt_local_search(order, &cost);
+	}
+	if (cost >= INFINITY)
+		fprintf(stderr, "repair: the tour takes a missing edge (cost %d)\n",
+				cost);
+	best_tour.cost = cost + 1; /* So that Update_best_tour takes it */
+	Update_best_tour(order, cost);
+} /* Repair_tour */
+
+/*------------------------------------------------------------------
+ * Function:            Complete_best_tour
+ * Purpose:             Make sure best_tour is a whole tour for an edit
+ *                      to repair.  A stopped solve, or a DFS of a
+ *                      single city, can leave it empty or partial; it
+ *                      is then replaced by a nearest neighbour tour.
+ * Global vars in:      n, mat
+ * Global vars in/out:  best_tour
+ */
+void Complete_best_tour(void) {
+	city_t* order;
+	weight_t cost;
+
+	if (best_tour.count == n + 1)
+		return;
+	order = malloc(n * sizeof(city_t));
+	Nearest_neighbor_tour(order);
+	cost = Tour_cost(order);
+	best_tour.cost = cost + 1; /* As in Repair_tour */
+	Update_best_tour(order, cost);
+	free(order);
+} /* Complete_best_tour */
+
+/*------------------------------------------------------------------
+ * Function:   Background_solve
+ * Purpose:    Thread function running Solve for Run_edits
+ * Out arg:    arg:  points to a flag set when Solve returns
+ */
+void *Background_solve(void* arg) {
+	Solve();
+	*(volatile int*) arg = TRUE;
+	return NULL;
+} /* Background_solve */
+
+/*------------------------------------------------------------------
+ * Function:   Run_edits
+ * Purpose:    Apply each edit in edit_file and print the repaired tour.
+ *             With resolve, then start an exact re-solve from it in the
+ *             background; the next edit stops it with Finish_search and
+ *             prints the best tour it had found.
+ * In args:    edit_file, resolve
+ */
+void Run_edits(FILE* edit_file, int resolve) {
+	char command[16], title[64];
+	weight_t* to_new, *from_new;
+	city_t k;
+	int edit = 0, i, running = FALSE, was_finished;
+	volatile int finished = FALSE;
+	pthread_t handle;
+
+	while (fscanf(edit_file, "%15s", command) == 1) {
+		if (running) {
+			was_finished = finished;
+			Finish_search();
+			pthread_join(handle, NULL);
+			solve_done = FALSE; /* In case Solve had already returned */
+			running = FALSE;
+			fprintf(stderr, "edit %d: re-solve %s after %.4f s\n", edit - 1,
+					was_finished ? "finished" : "stopped", Elapsed());
+			sprintf(title, "Best tour after edit %d", edit - 1);
+			Print_tour(&best_tour, title);
+			printf("Cost = %d\n", best_tour.cost);
+		}
+
+		if (strcmp(command, "add") == 0) {
+			to_new = malloc(n * sizeof(weight_t));
+			from_new = malloc(n * sizeof(weight_t));
+			for (i = 0; i < 2 * n; i++)
+				if (fscanf(edit_file, "%d", i < n ? &to_new[i]
+						: &from_new[i - n]) != 1) {
+					fprintf(stderr, "Edit %d is short\n", edit);
+					exit(1);
+				}
+			Add_city(to_new, from_new);
+			free(to_new);
+			free(from_new);
+		} else if (strcmp(command, "drop") == 0
+				&& fscanf(edit_file, "%d", &k) == 1 && k > 0 && k < n) {
+			Drop_city(k);
+		} else {
+			fprintf(stderr, "Bad edit %d\n", edit);
+			exit(1);
+		}
+		sprintf(title, "Repaired tour after edit %d", edit);
+		Print_tour(&best_tour, title);
+		printf("Cost = %d\n", best_tour.cost);
+		fflush(stdout);
+
+		if (resolve) {
+			finished = FALSE;
+			pthread_create(&handle, NULL, Background_solve, (void*) &finished);
+			running = TRUE;
+		}
+		edit++;
+	}
+
+	if (running) {
+		pthread_join(handle, NULL);
+		fprintf(stderr, "edit %d: re-solve finished after %.4f s\n",
+				edit - 1, Elapsed());
+		sprintf(title, "Best tour after edit %d", edit - 1);
+		Print_tour(&best_tour, title);
+		printf("Cost = %d\n", best_tour.cost);
+	}
+} /* Run_edits */
 
 /*------------------------------------------------------------------
  * Function:  Usage
@@ -148,7 +1577,18 @@ int main(int argc, char* argv[]) {
  * In arg:    prog_name
  */
 void Usage(char* prog_name) {
-	fprintf(stderr, "usage: %s <number of threads> <matrix file>\n", prog_name);
+	fprintf(stderr, "usage: %s [-e auto|dfs|anneal|aco|hk|portfolio|perm] "
+			"[-b none|minedge] [-w donate|pool] [-p <seconds>] [-H <dir>] "
+			"[-N <nodes>] [-E <seconds>] [-i <spins>] [-C] [-r] [-l] [-P] "
+			"[-B] [-u <delta file>] [-a <edit file> [-R]] "
+			"<number of threads> <matrix file>\n"
+			"       %s [-C] [-M <port>] -d <number of threads> <socket>\n"
+			"SIGINT stops the running solve and reports its best tour; a "
+			"second SIGINT ends\nthe program.  -B doesn't catch SIGINT.  "
+			"With -d, SIGTERM or SIGINT stops the\ndaemon once its queues "
+			"are empty.\n",
+			prog_name,
+			prog_name);
 	exit(0);
 } /* Usage */
 
@@ -162,6 +1602,7 @@ void Read_mat(FILE* mat_file) {
 	int i, j;
 
 	fscanf(mat_file, "%d", &n);
+	mat_capacity = n;
 	mat = malloc(n * n * sizeof(weight_t));
 
 	for (i = 0; i < n; i++)
@@ -169,6 +1610,236 @@ void Read_mat(FILE* mat_file) {
 			fscanf(mat_file, "%d", &mat[n * i + j]);
 } /* Read_mat */
 
+/*------------------------------------------------------------------
+ * Function:         Compute_min_edges
+ * Purpose:          Find the cheapest edge leaving each city
+ * Global vars in:   mat, n
+ * Global vars out:  min_out, min_out_total
+ */
+void Compute_min_edges(void) {
+	int i, j;
+
+	min_out = malloc(n * sizeof(weight_t));
+	min_out_total = 0;
+	for (i = 0; i < n; i++) {
+		min_out[i] = INFINITY;
+		for (j = 0; j < n; j++)
+			if (j != i && mat[n * i + j] < min_out[i])
+				min_out[i] = mat[n * i + j];
+		min_out_total += min_out[i];
+	}
+} /* Compute_min_edges */
+
+/*------------------------------------------------------------------
+ * Function:         Choose_root
+ * Purpose:          Find the city whose DFS tree, pruned against a
+ *                   nearest neighbour tour, Knuth probes estimate to be
+ *                   the smallest
+ * Global vars in:   mat, n, bound, min_out, min_out_total
+ * Ret val:          The root
+ */
+city_t Choose_root(void) {
+	city_t* order = malloc(n * sizeof(city_t));
+	double* levels = calloc(n + 1, sizeof(double));
+	city_t root, best_root = 0;
+	weight_t upper;
+	double size, best_size = 0.0;
+	unsigned seed = 1;
+	int p;
+
+	Nearest_neighbor_tour(order);
+	upper = Tour_cost(order);
+	for (root = 0; root < n; root++) {
+		size = 0.0;
+		for (p = 0; p < ROOT_PROBES; p++)
+			size += Knuth_probe(&root, 1, 0, upper, levels, &seed);
+		if (root == 0 || size < best_size) {
+			best_root = root;
+			best_size = size;
+		}
+	}
+	free(order);
+	free(levels);
+	return best_root;
+} /* Choose_root */
+
+/*------------------------------------------------------------------
+ * Function:            Relabel_root
+ * Purpose:             Swap root and city 0 in mat and min_out
+ * In arg:              root
+ * Global vars in/out:  mat, min_out, city_labels
+ */
+void Relabel_root(city_t root) {
+	city_t* order = malloc(n * sizeof(city_t));
+	weight_t tmp;
+	int i;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	order[0] = root;
+	order[root] = 0;
+	Relabel(order);
+	free(order);
+	tmp = min_out[0];
+	min_out[0] = min_out[root];
+	min_out[root] = tmp;
+} /* Relabel_root */
+
+/*------------------------------------------------------------------
+ * Function:            Relabel
+ * Purpose:             Renumber the cities so that city order[i]
+ *                      becomes city i, permuting mat, and compose the
+ *                      change with city_labels.  min_out is left alone.
+ * In arg:              order:  a permutation of the cities
+ * Global vars in/out:  mat, city_labels
+ */
+void Relabel(city_t* order) {
+	weight_t* new_mat = malloc(mat_capacity * mat_capacity * sizeof(weight_t));
+	city_t* labels = malloc(n * sizeof(city_t));
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			new_mat[n * i + j] = mat[n * order[i] + order[j]];
+	for (i = 0; i < n; i++)
+		labels[i] = city_labels == NULL ? order[i] : city_labels[order[i]];
+	free(mat);
+	mat = new_mat;
+	free(city_labels);
+	city_labels = labels;
+} /* Relabel */
+
+/*------------------------------------------------------------------
+ * Function:         Extract_features
+ * Purpose:          Measure the instance for Choose_engine:  symmetry,
+ *                   spread of the costs, a sample of triangle
+ *                   inequality violations, and the gap between the
+ *                   min-edge bound and a nearest neighbour tour
+ *                   improved by Or-opt
+ * Out args:         feat_p:  the features
+ *                   order:   the heuristic tour
+ * Global vars in:   mat, n, min_out_total
+ * Global vars out:  nbr_lists, nbr_count
+ */
+void Extract_features(features_t* feat_p, city_t* order) {
+	int i, j, k, s, equal = 0, violations = 0;
+	double sum = 0.0, sum_sq = 0.0, mean;
+	unsigned seed = 1;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++) {
+			if (i == j)
+				continue;
+			sum += mat[n * i + j];
+			sum_sq += (double) mat[n * i + j] * mat[n * i + j];
+			if (i < j && mat[n * i + j] == mat[n * j + i])
+				equal++;
+		}
+	mean = sum / ((double) n * (n - 1));
+	feat_p->symmetry = 2.0 * equal / ((double) n * (n - 1));
+	feat_p->spread = mean > 0.0 ?
+			sqrt(sum_sq / ((double) n * (n - 1)) - mean * mean) / mean : 0.0;
+
+	feat_p->triangle = 0.0;
+	if (n >= 3) {
+		for (s = 0; s < AUTO_TRIANGLE_SAMPLES; s++) {
+			i = rand_r(&seed) % n;
+			j = (i + 1 + rand_r(&seed) % (n - 1)) % n;
+			do
+				k = rand_r(&seed) % n;
+			while (k == i || k == j);
+			if (mat[n * i + k] > mat[n * i + j] + mat[n * j + k])
+				violations++;
+		}
+		feat_p->triangle = (double) violations / AUTO_TRIANGLE_SAMPLES;
+	}
+
+	Nearest_neighbor_tour(order);
+	feat_p->upper = Tour_cost(order);
+	if (n >= ANNEAL_MAX_SEG + 2) {
+		Build_nbr_lists(ACO_CAND);
+		Or_opt_local_search(order, &feat_p->upper);
+	}
+	feat_p->lower = min_out_total;
+	feat_p->gap = feat_p->lower > 0 ?
+			(double) (feat_p->upper - feat_p->lower) / feat_p->lower : 0.0;
+} /* Extract_features */
+
+/*------------------------------------------------------------------
+ * Function:            Choose_engine
+ * Purpose:             Pick the engine, bound and thread count from the
+ *                      features and log the decision on stderr.  An
+ *                      exact engine is used on its own if the cost model
+ *                      says it will finish within AUTO_EXACT_TIME.
+ *                      Otherwise moderate instances race the engines,
+ *                      and large ones use ACO if it is in its size range
+ *                      and the costs mostly obey the triangle inequality
+ *                      (so that the candidate lists are good), and
+ *                      anneal if not.  A bound or thread count the user
+ *                      gave is kept, and logged if auto would have
+ *                      picked another.
+ * In arg:              feat_p
+ * Global vars in:      n, bound_given, threads_given
+ * Global vars in/out:  bound, thread_count
+ * Global var out:      engine
+ */
+void Choose_engine(features_t* feat_p) {
+	double scale, est_dfs[2], est_hk = HUGE_VAL, est;
+	int b, auto_bound, serial;
+	char bound_note[64] = "", thread_note[64] = "";
+
+	scale = feat_p->gap / AUTO_CAL_GAP;
+	scale = scale < 0.5 ? 0.5 : (scale > 2.0 ? 2.0 : scale);
+	for (b = BOUND_NONE; b <= BOUND_MIN_EDGE; b++)
+		est_dfs[b] = AUTO_DFS_T14[b]
+				* pow(AUTO_DFS_RATE[b], (n - 14) * scale);
+	auto_bound = est_dfs[BOUND_MIN_EDGE] < est_dfs[BOUND_NONE] ?
+			BOUND_MIN_EDGE : BOUND_NONE;
+	if (!bound_given)
+		bound = auto_bound;
+	else if (bound != auto_bound)
+		sprintf(bound_note, " (given; auto would pick %s)",
+				bound_names[auto_bound]);
+	if (n <= Hk_max_n())
+		est_hk = AUTO_HK_NS * 1e-9 * n * n * pow(2.0, n);
+
+	if (feat_p->upper == feat_p->lower) {
+		engine = ENGINE_DFS; /* Heuristic tour is optimal, just prove it */
+		est = 0.0;
+	} else if (est_hk <= est_dfs[bound]) {
+		engine = ENGINE_HK;
+		est = est_hk;
+	} else {
+		engine = ENGINE_DFS;
+		est = est_dfs[bound];
+	}
+	serial = est < AUTO_SERIAL_TIME;
+	if (serial && !threads_given)
+		thread_count = 1;
+	else if (serial && thread_count > 1)
+		sprintf(thread_note, " (given; auto would pick 1)");
+	else if (est / thread_count > AUTO_EXACT_TIME) {
+		if (n <= AUTO_PORTFOLIO_MAX_N)
+			engine = ENGINE_PORTFOLIO;
+		else if (n >= AUTO_ACO_MIN_N && n <= AUTO_ACO_MAX_N
+				&& feat_p->triangle <= AUTO_TRIANGLE_MAX)
+			engine = ENGINE_ACO;
+		else
+			engine = ENGINE_ANNEAL;
+	}
+
+	fprintf(stderr, "auto: n = %d, symmetry = %.2f, spread = %.2f, "
+			"triangle = %.2f, bound = %d, tour = %d, gap = %.2f\n", n,
+			feat_p->symmetry, feat_p->spread, feat_p->triangle,
+			feat_p->lower, feat_p->upper, feat_p->gap);
+	fprintf(stderr, "auto: estimates dfs/none %.3g s, dfs/minedge %.3g s, "
+			"hk %.3g s\n", est_dfs[BOUND_NONE], est_dfs[BOUND_MIN_EDGE],
+			est_hk);
+	fprintf(stderr, "auto: engine = %s, bound = %s%s, threads = %d%s\n",
+			engine_names[engine], bound_names[bound], bound_note,
+			thread_count, thread_note);
+} /* Choose_engine */
+
 /*------------------------------------------------------------------
  * Function:        Print_mat
  * Purpose:         Print the number of cities and the matrix of costs
@@ -212,21 +1883,33 @@ void Initialize_tour(tour_t* tour_p) {
 void *Search(void* rank) {
 	long my_rank = (long) rank;
 
-	int l_best_tour = INFINITY;
+	int l_best_tour;
 	city_t nbr, city;
-	weight_t cost;
+	weight_t cost, lower;
 	tour_t* tour_p;
 	stack_elt_t* stack_p = NULL, *temp_p, *curr_p;
 	int partial_tour_count, first_final_city, last_final_city, quotient,
 			remainder, i;
 	volatile int my_count = 0;
+	long expanded = 0;
+	int children;
+	search_stats_t* my_stats = &search_stats[my_rank];
+	double start = Elapsed();
 
 #ifdef DEBUG
 	char title[50];
 #endif
 
-	quotient = (n - 1) / thread_count;
-	remainder = (n - 1) % thread_count;
+	if (perf_counters)
+		Start_perf(my_stats);
+
+	/* Start from any tour the heuristics have already found */
+	pthread_rwlock_rdlock(&best_tour_lock);
+	l_best_tour = best_tour.cost;
+	pthread_rwlock_unlock(&best_tour_lock);
+
+	quotient = (n - 1) / dfs_thread_count;
+	remainder = (n - 1) % dfs_thread_count;
 	if (my_rank < remainder) {
 		partial_tour_count = quotient + 1;
 		first_final_city = my_rank * partial_tour_count + 1;
@@ -235,6 +1918,10 @@ void *Search(void* rank) {
 		first_final_city = my_rank * partial_tour_count + remainder + 1;
 	}
 	last_final_city = first_final_city + partial_tour_count - 1;
+	/* Terminated claims prefixes from the pool; a resumed solve starts
+	 * from its share of the parked stacks */
+	if (work_mode == WORK_POOL || resume_stacks != NULL)
+		last_final_city = first_final_city - 1;
 
 	for (i = first_final_city; i <= last_final_city; i++) {
 		tour_p = malloc(sizeof(tour_t));
@@ -258,6 +1945,10 @@ void *Search(void* rank) {
 		}
 		my_count++;
 	}
+	if (resume_stacks != NULL) {
+		stack_p = resume_stacks[my_rank];
+		my_count = resume_sizes[my_rank];
+	}
 
 #	ifdef DEBUG
 	sprintf(title, "Stack from thread %ld", my_rank);
@@ -268,24 +1959,44 @@ void *Search(void* rank) {
 	while (!Terminated(&stack_p, &my_count, my_rank)) {
 		Pop(&tour_p, &city, &cost, &stack_p);
 		my_count--;
+		if (++expanded % INCUMBENT_POLL == 0) {
+			/* Pick up tours published by other threads or engines */
+			Timed_rdlock(&best_tour_lock, my_stats);
+			l_best_tour = best_tour.cost;
+			pthread_rwlock_unlock(&best_tour_lock);
+			if (node_budget > 0)
+				__atomic_add_fetch(&nodes_charged, INCUMBENT_POLL,
+						__ATOMIC_RELAXED);
+			Stop_requested();
+			my_stats->depth = tour_p->count + 1;
+			my_stats->stack_size = my_count;
+		}
 		tour_p->cities[tour_p->count] = city;
 		tour_p->cost += cost;
 		tour_p->count++;
+		my_stats->nodes[tour_p->count]++;
 		if (tour_p->count == n) {
-			Check_best_tour(city, tour_p, &l_best_tour);
+			Check_best_tour(city, tour_p, &l_best_tour, my_stats);
 		} else {
+			lower = Lower_bound(tour_p);
+			children = 0;
 			for (nbr = n - 1; nbr > 0; nbr--) {
-				if (Feasible(city, nbr, tour_p, l_best_tour)) {
+				if (Feasible(city, nbr, tour_p, lower, l_best_tour)) {
 					Push(tour_p, nbr, mat[n * city + nbr], &stack_p);
 					my_count++;
+					children++;
 				}
 			}
+			my_stats->prunes[tour_p->count] += n - tour_p->count - children;
 		}
 		/* Push duplicates the tour.  So it needs to be freed */
 		free(tour_p->cities);
 		free(tour_p);
 	} /* while */
 
+	if (perf_counters)
+		Stop_perf(my_stats);
+	my_stats->run_time = Elapsed() - start;
 	return NULL;
 } /* Search */
 
@@ -295,17 +2006,19 @@ void *Search(void* rank) {
  *                      better than the current best tour.  If so, update
  *                      best_tour
  * In args:             city, tour_p
+ * In/out arg:          my_stats:  the caller's lock_time, or NULL
  * Global vars in:      mat, n
  * Global vars in/out:  best_tour
  */
-void Check_best_tour(city_t city, tour_t* tour_p, int *l_best_tour) {
+void Check_best_tour(city_t city, tour_t* tour_p, int *l_best_tour,
+		search_stats_t* my_stats) {
 	int i;
 
-	pthread_rwlock_rdlock(&best_tour_lock);
+	Timed_rdlock(&best_tour_lock, my_stats);
 	*l_best_tour = best_tour.cost;
 	if (tour_p->cost + mat[city * n + 0] < best_tour.cost) {
 		pthread_rwlock_unlock(&best_tour_lock);
-		pthread_rwlock_wrlock(&best_tour_lock);
+		Timed_wrlock(&best_tour_lock, my_stats);
 		if (tour_p->cost + mat[city * n + 0] < best_tour.cost) {
 			for (i = 0; i < tour_p->count; i++)
 				best_tour.cities[i] = tour_p->cities[i];
@@ -325,19 +2038,43 @@ void Check_best_tour(city_t city, tour_t* tour_p, int *l_best_tour) {
  *                  in the current tour, and, if not, whether adding the
  *                  edge from the current city to nbr will result in
  *                  a cost less than the current best cost.
- * In args:         All
- * Global vars in:  mat, n, best_tour
+ * In args:         All.  lower is Lower_bound(tour_p).
+ * Global vars in:  mat, n
  * Return:          TRUE if the nbr can be added to the current tour.
  *                  FALSE otherwise
  */
-int Feasible(city_t city, city_t nbr, tour_t* tour_p, int l_best_tour) {
-	if (!Visited(nbr, tour_p) && tour_p -> cost + mat[n * city + nbr]
+int Feasible(city_t city, city_t nbr, tour_t* tour_p, weight_t lower,
+		int l_best_tour) {
+	if (!Visited(nbr, tour_p) && lower + mat[n * city + nbr]
 			< l_best_tour)
 		return TRUE;
 	else
 		return FALSE;
 } /* Feasible */
 
+/*------------------------------------------------------------------
+ * Function:        Lower_bound
+ * Purpose:         Bound the cost of any tour completing tour_p, less
+ *                  the edge out of its last city.  With BOUND_MIN_EDGE
+ *                  every city not yet left must still be left once, by
+ *                  an edge costing at least min_out of that city.
+ * In arg:          tour_p
+ * Global vars in:  bound, min_out, min_out_total
+ * Ret val:         The bound; the cost of tour_p with BOUND_NONE
+ */
+weight_t Lower_bound(tour_t* tour_p) {
+	int i;
+	weight_t rest;
+
+	if (bound == BOUND_NONE)
+		return tour_p->cost;
+	/* The last city's own exit is the edge Feasible adds */
+	rest = min_out_total;
+	for (i = 0; i < tour_p->count; i++)
+		rest -= min_out[tour_p->cities[i]];
+	return tour_p->cost + rest;
+} /* Lower_bound */
+
 /*------------------------------------------------------------------
  * Function:   Visited
  * Purpose:    Use linear search to determine whether nbr has already
@@ -361,11 +2098,22 @@ int Visited(city_t nbr, tour_t* tour_p) {
  * In args:   All
  */
 void Print_tour(tour_t* tour_p, char* title) {
-	int i;
+	int i, start = 0;
 
 	printf("%s:\n", title);
-	for (i = 0; i < tour_p->count; i++)
-		printf("%d ", tour_p->cities[i]);
+	if (city_labels == NULL) {
+		for (i = 0; i < tour_p->count; i++)
+			printf("%d ", tour_p->cities[i]);
+	} else if (tour_p->count == n + 1) {
+		/* A complete tour:  start it from the input's city 0 */
+		while (city_labels[tour_p->cities[start]] != 0)
+			start++;
+		for (i = 0; i <= n; i++)
+			printf("%d ", city_labels[tour_p->cities[(start + i) % n]]);
+	} else {
+		for (i = 0; i < tour_p->count; i++)
+			printf("%d ", city_labels[tour_p->cities[i]]);
+	}
 	printf("\n\n");
 } /* Print_tour */
 
@@ -449,29 +2197,97 @@ int Empty(stack_elt_t* stack_p) {
  */
 int Terminated(stack_elt_t** my_stack, volatile int* my_stack_size,
 		long my_rank) {
+	weight_t lower;
+	search_stats_t* my_stats = &search_stats[my_rank];
+	int spins, slept;
+	double wait, idle_start, split_start;
 
-	if (*my_stack_size >= 2 && threads_in_cond_wait > 0 && new_stack == NULL) {
-		pthread_mutex_lock(&term_mutex);
+	if (my_rank >= dfs_target && !solve_done)
+		Bench(my_stack, my_stack_size, my_rank); /* Back with no work */
+	if (solve_done) { /* Another engine has proved optimality, or stop */
+		if (solve_parking) {
+			Park_stack(*my_stack, *my_stack_size);
+		} else {
+			lower = Stack_bound(*my_stack);
+			pthread_mutex_lock(&term_mutex);
+			if (lower < frontier_bound)
+				frontier_bound = lower;
+			pthread_mutex_unlock(&term_mutex);
+			Free_stack(*my_stack);
+		}
+		*my_stack = NULL;
+		*my_stack_size = 0;
+		return TRUE;
+	} else if (*my_stack_size >= 2 && threads_in_cond_wait > 0 && new_stack == NULL) {
+		Timed_lock(&term_mutex, my_stats);
 		if (threads_in_cond_wait > 0 && new_stack == NULL) {
+			split_start = Elapsed();
 			Split_stack(*my_stack, my_stack_size, my_rank);
+			new_stack_since = Elapsed();
+			my_stats->split_time += new_stack_since - split_start;
 			pthread_cond_signal(&term_cond_var);
 		}
 		pthread_mutex_unlock(&term_mutex);
 		return FALSE; /* Terminated = False; dont quit */
 	} else if (!Empty(*my_stack)) { /* Stack not empty, keep working */
 		return FALSE; /* Terminated = False; dont quit */
+	} else if (work_mode == WORK_POOL && Claim_prefix(my_stack, my_stack_size)) {
+		return FALSE; /* Got the next prefix from the pool */
 	} else { /* My stack is empty */
-		pthread_mutex_lock(&term_mutex);
-		if (threads_in_cond_wait == thread_count - 1) { /* Last thread running */
+		Timed_lock(&term_mutex, my_stats);
+		/* Last thread running, and no donated stack still unclaimed */
+		if (threads_in_cond_wait == dfs_active - 1 && new_stack == NULL) {
 			threads_in_cond_wait++;
+			solve_complete = TRUE;
+			solve_done = TRUE;
 			pthread_cond_broadcast(&term_cond_var);
+			pthread_cond_broadcast(&bench_cond);
 			pthread_mutex_unlock(&term_mutex);
 			return TRUE; /* Terminated = true; quit */
 		} else { /* Other threads still working, wait for work */
 			threads_in_cond_wait++;
-			while (pthread_cond_wait(&term_cond_var, &term_mutex) != 0)
-				; /* Weve been awakened */
-			if (threads_in_cond_wait < thread_count) { /* We got work */
+			idle_start = Elapsed();
+			my_stats->depth = my_stats->stack_size = 0;
+			if (my_stats->spin_limit > 0) {
+				pthread_mutex_unlock(&term_mutex);
+				/* new_stack is written under term_mutex, so it must be
+				 * loaded atomically here, or it could be read once and
+				 * the loop never see the donation */
+				for (spins = 0; spins < my_stats->spin_limit
+						&& !solve_done && my_rank < dfs_target
+						&& __atomic_load_n(&new_stack, __ATOMIC_ACQUIRE)
+								== NULL; spins++)
+#					if defined(__x86_64__)
+					__builtin_ia32_pause();
+#					else
+					;
+#					endif
+				pthread_mutex_lock(&term_mutex);
+			}
+			slept = FALSE;
+			while (new_stack == NULL && !solve_done
+					&& threads_in_cond_wait < dfs_active
+					&& my_rank < dfs_target) {
+				slept = TRUE;
+				pthread_cond_wait(&term_cond_var, &term_mutex);
+			}
+			my_stats->wait_time += Elapsed() - idle_start;
+			if (my_rank >= dfs_target && !solve_done) { /* Asked to leave */
+				threads_in_cond_wait--;
+				pthread_mutex_unlock(&term_mutex);
+				return Terminated(my_stack, my_stack_size, my_rank);
+			} else if (new_stack != NULL && !solve_done) { /* We got work */
+				wait = Elapsed() - new_stack_since;
+				my_stats->handoffs[slept]++;
+				my_stats->handoff_wait[slept] += wait;
+				if (wait > my_stats->handoff_max)
+					my_stats->handoff_max = wait;
+				if (slept && my_stats->spin_limit > SPIN_MIN)
+					my_stats->spin_limit = my_stats->spin_limit / 2 > SPIN_MIN
+							? my_stats->spin_limit / 2 : SPIN_MIN;
+				else if (!slept && my_stats->spin_limit < idle_spins)
+					my_stats->spin_limit = 2 * my_stats->spin_limit < idle_spins
+							? 2 * my_stats->spin_limit : idle_spins;
 				*my_stack = new_stack;
 				*my_stack_size = new_stack_size;
 				new_stack = NULL;
@@ -568,3 +2384,3092 @@ void Print_stack(stack_elt_t* stack_p, char* title) {
 	sprintf(buffer,"%s\n", buffer);
 	printf("%-20s = %s", title, buffer);
 } /* Print_stack */
+
+/*------------------------------------------------------------------
+ * Function:  Free_stack
+ * Purpose:   Free every record on a stack along with its tour
+ * In arg:    stack_p
+ */
+void Free_stack(stack_elt_t* stack_p) {
+	stack_elt_t* next_p;
+
+	while (stack_p != NULL) {
+		next_p = stack_p->next_p;
+		free(stack_p->tour_p->cities);
+		free(stack_p->tour_p);
+		free(stack_p);
+		stack_p = next_p;
+	}
+} /* Free_stack */
+
+/*------------------------------------------------------------------
+ * Function:         Finish_search
+ * Purpose:          Called by an exact engine that has finished:  tell
+ *                   every other engine to stop, waking any DFS threads
+ *                   that are waiting for work
+ * Global vars out:  solve_done
+ */
+void Finish_search(void) {
+	pthread_mutex_lock(&term_mutex);
+	solve_done = TRUE;
+	pthread_cond_broadcast(&term_cond_var);
+	pthread_cond_broadcast(&bench_cond);
+	pthread_mutex_unlock(&term_mutex);
+} /* Finish_search */
+
+/*------------------------------------------------------------------
+ * Function:            Bench
+ * Purpose:             Leave the search:  hand my_stack over as a
+ *                      donated stack, and sleep until my_rank is below
+ *                      dfs_target again or the solve is over.  Ends
+ *                      the search if everyone left is idle.
+ * In arg:              my_rank
+ * In/out args:         my_stack, my_stack_size:  empty on return
+ * Global vars in:      dfs_target
+ * Global vars in/out:  new_stack, new_stack_size, dfs_active,
+ *                      solve_done, solve_complete
+ */
+void Bench(stack_elt_t** my_stack, volatile int* my_stack_size,
+		long my_rank) {
+	stack_elt_t* last_p;
+	double start;
+
+	pthread_mutex_lock(&term_mutex);
+	if (*my_stack != NULL) {
+		/* Put it in front of any stack already waiting to be claimed */
+		for (last_p = *my_stack; last_p->next_p != NULL;
+				last_p = last_p->next_p)
+			;
+		if (new_stack == NULL)
+			new_stack_since = Elapsed();
+		last_p->next_p = new_stack;
+		new_stack = *my_stack;
+		new_stack_size += *my_stack_size;
+		*my_stack = NULL;
+		*my_stack_size = 0;
+		pthread_cond_signal(&term_cond_var);
+	}
+	dfs_active--;
+	if (threads_in_cond_wait == dfs_active && new_stack == NULL) {
+		solve_complete = TRUE;
+		solve_done = TRUE;
+		pthread_cond_broadcast(&term_cond_var);
+	}
+	start = Elapsed();
+	while (my_rank >= dfs_target && !solve_done)
+		pthread_cond_wait(&bench_cond, &term_mutex);
+	search_stats[my_rank].bench_time += Elapsed() - start;
+	dfs_active++;
+	pthread_mutex_unlock(&term_mutex);
+} /* Bench */
+
+/*------------------------------------------------------------------
+ * Function:         Set_dfs_target
+ * Purpose:          Change the number of DFS threads that should run,
+ *                   waking the ones that should leave or come back
+ * In arg:           target:  1 to dfs_thread_count
+ * Global vars out:  dfs_target
+ */
+void Set_dfs_target(int target) {
+	pthread_mutex_lock(&term_mutex);
+	dfs_target = target;
+	pthread_cond_broadcast(&term_cond_var);
+	pthread_cond_broadcast(&bench_cond);
+	pthread_mutex_unlock(&term_mutex);
+} /* Set_dfs_target */
+
+/*------------------------------------------------------------------
+ * Function:         Resizer
+ * Purpose:          Every elastic_interval seconds, fit the number of
+ *                   DFS threads running to the CPUs left over by the
+ *                   other engines, until the solve ends
+ * Global vars in:   elastic_interval, dfs_thread_count,
+ *                   heur_thread_count, hk_thread_count, monitor_stop,
+ *                   solve_done
+ */
+void *Resizer(void* arg) {
+	double next = 0.0, now;
+	int target;
+
+	while (!monitor_stop && !solve_done) {
+		now = Elapsed();
+		if (now >= next) {
+			next = now + elastic_interval;
+			target = Available_cpus() - heur_thread_count - hk_thread_count;
+			if (target < 1)
+				target = 1;
+			if (target > dfs_thread_count)
+				target = dfs_thread_count;
+			if (target != dfs_target) {
+				fprintf(stderr, "elastic: %.2f s, %d -> %d DFS threads\n", now,
+						dfs_target, target);
+				Set_dfs_target(target);
+			}
+		}
+		Monitor_nap(10);
+	}
+	return NULL;
+} /* Resizer */
+
+/*------------------------------------------------------------------
+ * Function:   Available_cpus
+ * Purpose:    Count the CPUs this process may run on, allowing for
+ *             its affinity mask and its cgroup's CPU quota
+ * Ret val:    The count, at least 1
+ */
+int Available_cpus(void) {
+	cpu_set_t cpus;
+	int count = 0, quota = Cgroup_cpus();
+
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+		count = CPU_COUNT(&cpus);
+	if (quota > 0 && (quota < count || count == 0))
+		count = quota;
+	return count > 0 ? count : 1;
+} /* Available_cpus */
+
+/*------------------------------------------------------------------
+ * Function:   Cgroup_cpus
+ * Purpose:    Find the CPU quota of this process's cgroup, as found
+ *             through /proc/self/cgroup, in cgroup v2 or v1
+ * Ret val:    The quota in CPUs, rounded up, or 0 if there is none
+ */
+int Cgroup_cpus(void) {
+	FILE* file;
+	char line[512], v2_dir[512] = "", v1_dir[512] = "", path[1100], *p;
+	char max[32];
+	long quota = -1, period = 0;
+
+	file = fopen("/proc/self/cgroup", "r");
+	if (file == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "0::", 3) == 0)
+			strcpy(v2_dir, line + 3);
+		else if (((p = strstr(line, ":cpu:")) != NULL
+				|| (p = strstr(line, ":cpu,")) != NULL)
+				&& (p = strchr(p + 1, ':')) != NULL)
+			strcpy(v1_dir, p + 1);
+	}
+	fclose(file);
+
+	/* v2:  "max <period>" or "<quota> <period>" */
+	snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", v2_dir);
+	if ((file = fopen(path, "r")) != NULL) {
+		if (fscanf(file, "%31s %ld", max, &period) == 2
+				&& strcmp(max, "max") != 0)
+			quota = strtol(max, NULL, 10);
+		fclose(file);
+	} else {
+		/* v1:  a quota of -1 means none */
+		snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/cpu.cfs_quota_us",
+				v1_dir);
+		if ((file = fopen(path, "r")) != NULL) {
+			if (fscanf(file, "%ld", &quota) != 1)
+				quota = -1;
+			fclose(file);
+		}
+		snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/cpu.cfs_period_us",
+				v1_dir);
+		if ((file = fopen(path, "r")) != NULL) {
+			if (fscanf(file, "%ld", &period) != 1)
+				period = 0;
+			fclose(file);
+		}
+	}
+	if (quota <= 0 || period <= 0)
+		return 0;
+	return (quota + period - 1) / period;
+} /* Cgroup_cpus */
+
+/*------------------------------------------------------------------
+ * Function:         Stop_requested
+ * Purpose:          Finish the search if it has been cancelled or has
+ *                   used up its node budget.  Cheap enough to call
+ *                   every INCUMBENT_POLL nodes.
+ * Global vars in:   cancel_requested, node_budget, nodes_charged
+ * Ret val:          solve_done
+ */
+int Stop_requested(void) {
+	if (!solve_done && (cancel_requested
+			|| (node_budget > 0 && nodes_charged >= node_budget)))
+		Finish_search();
+	return solve_done;
+} /* Stop_requested */
+
+/*------------------------------------------------------------------
+ * Function:         Cancel_handler
+ * Purpose:          Ask the solve to stop.  Only sets a flag, which is
+ *                   async-signal-safe; Stop_requested does the rest.
+ * In arg:           sig
+ * Global var out:   cancel_requested
+ */
+void Cancel_handler(int sig) {
+	cancel_requested = TRUE;
+} /* Cancel_handler */
+
+/*------------------------------------------------------------------
+ * Function:         Snapshot_handler
+ * Purpose:          Ask the Monitor for a snapshot.  Only sets a flag,
+ *                   as Cancel_handler does.
+ * In arg:           sig
+ * Global var out:   snapshot_requested
+ */
+void Snapshot_handler(int sig) {
+	snapshot_requested = TRUE;
+} /* Snapshot_handler */
+
+/*------------------------------------------------------------------
+ * Function:   Stack_bound
+ * Purpose:    Bound the cost of any tour below the records on a stack:
+ *             a record's cost so far plus the cheapest exit from its
+ *             last city and from each city it has not visited
+ * In arg:     stack_p
+ * Ret val:    The least bound over the records, INFINITY if none
+ */
+weight_t Stack_bound(stack_elt_t* stack_p) {
+	weight_t lower = INFINITY, rest;
+	int i;
+
+	for (; stack_p != NULL; stack_p = stack_p->next_p) {
+		/* The record's city is not in tour_p yet */
+		rest = min_out_total;
+		for (i = 0; i < stack_p->tour_p->count; i++)
+			rest -= min_out[stack_p->tour_p->cities[i]];
+		if (stack_p->tour_p->cost + stack_p->cost + rest < lower)
+			lower = stack_p->tour_p->cost + stack_p->cost + rest;
+	}
+	return lower;
+} /* Stack_bound */
+
+/*------------------------------------------------------------------
+ * Function:         Pool_bound
+ * Purpose:          Stack_bound for the prefixes still in the pool
+ * Global vars in:   pool_prefixes, pool_depth, pool_count, pool_next
+ * Ret val:          The least bound, INFINITY if none are left
+ */
+weight_t Pool_bound(void) {
+	weight_t lower = INFINITY, cost;
+	city_t* prefix;
+	long idx;
+	int i;
+
+	if (pool_prefixes == NULL)
+		return INFINITY;
+	for (idx = pool_next; idx < pool_count; idx++) {
+		prefix = &pool_prefixes[(pool_depth + 1) * idx];
+		cost = min_out_total;
+		for (i = 0; i < pool_depth; i++)
+			cost -= min_out[prefix[i]];
+		for (i = 1; i <= pool_depth; i++)
+			cost += mat[n * prefix[i - 1] + prefix[i]];
+		if (cost < lower)
+			lower = cost;
+	}
+	return lower;
+} /* Pool_bound */
+
+/*------------------------------------------------------------------
+ * Function:         Park_search
+ * Purpose:          Stop the engines as Finish_search does, but have
+ *                   the DFS threads keep their stacks on parked_stack
+ *                   for a later Solve to resume
+ * Global vars out:  solve_parking, solve_done
+ */
+void Park_search(void) {
+	solve_parking = TRUE;
+	Finish_search();
+} /* Park_search */
+
+/*------------------------------------------------------------------
+ * Function:            Park_stack
+ * Purpose:             Put a stack on the front of parked_stack
+ * In args:             stack_p, size
+ * Global vars in/out:  parked_stack, parked_size
+ */
+void Park_stack(stack_elt_t* stack_p, int size) {
+	stack_elt_t* last_p;
+
+	if (stack_p == NULL)
+		return;
+	for (last_p = stack_p; last_p->next_p != NULL; last_p = last_p->next_p)
+		;
+	pthread_mutex_lock(&term_mutex);
+	last_p->next_p = parked_stack;
+	parked_stack = stack_p;
+	parked_size += size;
+	pthread_mutex_unlock(&term_mutex);
+} /* Park_stack */
+
+/*------------------------------------------------------------------
+ * Function:            Deal_parked_stack
+ * Purpose:             Deal parked_stack out to the DFS threads one
+ *                      record at a time, so that each gets a mix of
+ *                      shallow and deep partial tours
+ * Global vars in:      dfs_thread_count
+ * Global vars in/out:  parked_stack, parked_size
+ * Global vars out:     resume_stacks, resume_sizes
+ */
+void Deal_parked_stack(void) {
+	stack_elt_t** tails;
+	stack_elt_t* curr_p;
+	int i = 0;
+
+	resume_stacks = calloc(dfs_thread_count, sizeof(stack_elt_t*));
+	resume_sizes = calloc(dfs_thread_count, sizeof(int));
+	tails = malloc(dfs_thread_count * sizeof(stack_elt_t*));
+	while (parked_stack != NULL) {
+		curr_p = parked_stack;
+		parked_stack = curr_p->next_p;
+		curr_p->next_p = NULL;
+		if (resume_stacks[i] == NULL)
+			resume_stacks[i] = curr_p;
+		else
+			tails[i]->next_p = curr_p;
+		tails[i] = curr_p;
+		resume_sizes[i]++;
+		i = (i + 1) % dfs_thread_count;
+	}
+	parked_size = 0;
+	free(tails);
+} /* Deal_parked_stack */
+
+/*------------------------------------------------------------------
+ * Function:         Build_prefix_pool
+ * Purpose:          List the feasible partial tours for the DFS threads
+ *                   to claim.  pool_depth is the smallest number of
+ *                   cities after 0 that Estimate_subtree expects to
+ *                   give POOL_TASKS_PER_THREAD feasible prefixes per
+ *                   thread, and at most n - 2.  It stops early where
+ *                   the estimated tree stops widening, since deeper
+ *                   prefixes wouldn't be more numerous.
+ * Global vars in:   n, dfs_thread_count, best_tour
+ * Global vars out:  pool_depth, pool_prefixes, pool_count, pool_next
+ */
+void Build_prefix_pool(void) {
+	city_t root = 0;
+	double* levels = malloc((n + 1) * sizeof(double));
+	long capacity = 1024;
+	unsigned seed = 1;
+	int l_best_tour;
+
+	Estimate_subtree(&root, 1, 0, PROGRESS_PROBES, levels, &seed);
+	pool_depth = 1;
+	while (pool_depth < n - 2
+			&& levels[pool_depth + 1]
+				< (double) POOL_TASKS_PER_THREAD * dfs_thread_count
+			&& levels[pool_depth + 2] > levels[pool_depth + 1])
+		pool_depth++;
+	free(levels);
+	pool_prefixes = malloc(capacity * (pool_depth + 1) * sizeof(city_t));
+	pool_count = 0;
+	pool_next = 0;
+	pthread_rwlock_rdlock(&best_tour_lock);
+	l_best_tour = best_tour.cost;
+	pthread_rwlock_unlock(&best_tour_lock);
+	Enumerate_prefixes(&root, 1, 0, l_best_tour, &capacity);
+} /* Build_prefix_pool */
+
+/*------------------------------------------------------------------
+ * Function:            Enumerate_prefixes
+ * Purpose:             Append to pool_prefixes every extension of a
+ *                      partial tour to pool_depth + 1 cities that is
+ *                      not pruned by the bound and the incumbent
+ * In args:             prefix, count, cost:  the partial tour, its
+ *                         number of cities and its cost
+ *                      l_best_tour:  cost of the incumbent
+ * In/out arg:          capacity_p:  prefixes pool_prefixes can hold
+ * Global vars in:      mat, n, pool_depth
+ * Global vars in/out:  pool_prefixes, pool_count
+ */
+void Enumerate_prefixes(city_t* prefix, int count, weight_t cost,
+		int l_best_tour, long* capacity_p) {
+	city_t* longer;
+	city_t nbr, city = prefix[count - 1];
+	tour_t tour;
+	weight_t lower;
+	int i;
+
+	if (count == pool_depth + 1) {
+		if (pool_count == *capacity_p) {
+			*capacity_p *= 2;
+			pool_prefixes = realloc(pool_prefixes,
+					*capacity_p * (pool_depth + 1) * sizeof(city_t));
+		}
+		memcpy(&pool_prefixes[(pool_depth + 1) * pool_count], prefix,
+				count * sizeof(city_t));
+		pool_count++;
+		return;
+	}
+
+	tour.cities = prefix;
+	tour.count = count;
+	tour.cost = cost;
+	lower = Lower_bound(&tour);
+	longer = malloc((count + 1) * sizeof(city_t));
+	for (i = 0; i < count; i++)
+		longer[i] = prefix[i];
+	for (nbr = 1; nbr < n; nbr++)
+		if (Feasible(city, nbr, &tour, lower, l_best_tour)) {
+			longer[count] = nbr;
+			Enumerate_prefixes(longer, count + 1, cost + mat[n * city + nbr],
+					l_best_tour, capacity_p);
+		}
+	free(longer);
+} /* Enumerate_prefixes */
+
+/*------------------------------------------------------------------
+ * Function:         Claim_prefix
+ * Purpose:          Take the next prefix from the pool and make it the
+ *                   only record on an empty stack
+ * Out args:         my_stack, my_stack_size
+ * Global vars in:   mat, n, pool_prefixes, pool_depth, pool_count
+ * Global vars in/out:  pool_next
+ * Ret val:          TRUE if a prefix was claimed, FALSE if the pool is
+ *                   used up
+ */
+int Claim_prefix(stack_elt_t** my_stack, volatile int* my_stack_size) {
+	long idx;
+	city_t* prefix;
+	tour_t* tour_p;
+	int i;
+
+	if (pool_next >= pool_count)
+		return FALSE;
+	idx = __atomic_fetch_add(&pool_next, 1, __ATOMIC_RELAXED);
+	if (idx >= pool_count)
+		return FALSE;
+
+	/* As in Search:  the record holds the last city, not yet added */
+	prefix = &pool_prefixes[(pool_depth + 1) * idx];
+	tour_p = malloc(sizeof(tour_t));
+	Initialize_tour(tour_p);
+	for (i = 0; i < pool_depth; i++) {
+		tour_p->cities[i] = prefix[i];
+		if (i > 0)
+			tour_p->cost += mat[n * prefix[i - 1] + prefix[i]];
+	}
+	tour_p->count = pool_depth;
+
+	*my_stack = malloc(sizeof(stack_elt_t));
+	(*my_stack)->tour_p = tour_p;
+	(*my_stack)->city = prefix[pool_depth];
+	(*my_stack)->cost = mat[n * prefix[pool_depth - 1] + prefix[pool_depth]];
+	(*my_stack)->next_p = NULL;
+	*my_stack_size = 1;
+	return TRUE;
+} /* Claim_prefix */
+
+/*------------------------------------------------------------------
+ * Function:  Start_threads
+ * Purpose:   Start count threads running thread_fn with ranks
+ *            0, 1, ..., count-1
+ * In args:   thread_fn, count
+ * Out arg:   handles
+ */
+void Start_threads(void *(*thread_fn)(void*), int count, pthread_t* handles) {
+	long i;
+
+	if (worker_count == 0) {
+		for (i = 0; i < count; i++)
+			pthread_create(&handles[i], NULL, thread_fn, (void*) i);
+		return;
+	}
+	pthread_mutex_lock(&worker_mutex);
+	for (i = 0; i < count; i++) {
+		worker_tasks[worker_next + i].fn = thread_fn;
+		worker_tasks[worker_next + i].rank = i;
+	}
+	worker_next += count;
+	worker_busy += count;
+	pthread_cond_broadcast(&worker_cond);
+	pthread_mutex_unlock(&worker_mutex);
+} /* Start_threads */
+
+/*------------------------------------------------------------------
+ * Function:   Join_threads
+ * Purpose:    Wait for everything Start_threads started since the last
+ *             call:  count threads in handles, or all busy workers
+ * In args:    count, handles
+ */
+void Join_threads(int count, pthread_t* handles) {
+	int i;
+
+	if (worker_count == 0) {
+		for (i = 0; i < count; i++)
+			pthread_join(handles[i], NULL);
+		return;
+	}
+	pthread_mutex_lock(&worker_mutex);
+	while (worker_busy > 0)
+		pthread_cond_wait(&worker_idle_cond, &worker_mutex);
+	worker_next = 0;
+	pthread_mutex_unlock(&worker_mutex);
+} /* Join_threads */
+
+/*------------------------------------------------------------------
+ * Function:   Worker
+ * Purpose:    Persistent thread:  run each task Start_threads gives
+ *             this worker until worker_quit is set
+ * In arg:     rank:  index in worker_tasks
+ */
+void *Worker(void* rank) {
+	worker_task_t* task_p = &worker_tasks[(long) rank];
+	void *(*fn)(void*);
+
+	pthread_mutex_lock(&worker_mutex);
+	while (TRUE) {
+		while (task_p->fn == NULL && !worker_quit)
+			pthread_cond_wait(&worker_cond, &worker_mutex);
+		if (task_p->fn == NULL)
+			break;
+		fn = task_p->fn;
+		pthread_mutex_unlock(&worker_mutex);
+		fn((void*) task_p->rank);
+		pthread_mutex_lock(&worker_mutex);
+		task_p->fn = NULL;
+		if (--worker_busy == 0)
+			pthread_cond_broadcast(&worker_idle_cond);
+	}
+	pthread_mutex_unlock(&worker_mutex);
+	return NULL;
+} /* Worker */
+
+/*------------------------------------------------------------------
+ * Function:        Elapsed
+ * Purpose:         Wall clock time since the solve started
+ * Global vars in:  solve_start
+ * Ret val:         Seconds
+ */
+double Elapsed(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - solve_start.tv_sec)
+			+ (now.tv_nsec - solve_start.tv_nsec) / 1e9;
+} /* Elapsed */
+
+/*------------------------------------------------------------------
+ * Function:        Print_handoffs
+ * Purpose:         Report on stderr how long donated stacks waited to
+ *                  be claimed, by threads spinning and by threads that
+ *                  had gone to sleep
+ * Global vars in:  search_stats, dfs_thread_count, idle_spins
+ */
+void Print_handoffs(void) {
+	long count[2] = { 0, 0 };
+	double wait[2] = { 0.0, 0.0 }, max = 0.0;
+	int t, mode;
+
+	for (t = 0; t < dfs_thread_count; t++) {
+		for (mode = 0; mode < 2; mode++) {
+			count[mode] += search_stats[t].handoffs[mode];
+			wait[mode] += search_stats[t].handoff_wait[mode];
+		}
+		if (search_stats[t].handoff_max > max)
+			max = search_stats[t].handoff_max;
+	}
+	fprintf(stderr, "handoffs: %ld claimed awake (mean %.1f us), %ld after sleeping "
+			"(mean %.1f us), max %.1f us, spins <= %d\n", count[0],
+			count[0] > 0 ? 1e6 * wait[0] / count[0] : 0.0, count[1],
+			count[1] > 0 ? 1e6 * wait[1] / count[1] : 0.0, 1e6 * max,
+			idle_spins);
+} /* Print_handoffs */
+
+/*------------------------------------------------------------------
+ * Function:    Timed_lock
+ * Purpose:     Lock mutex_p, adding the time spent waiting for it to
+ *              my_stats->lock_time if it was held by another thread
+ * In/out args: mutex_p, my_stats:  NULL for no timing
+ */
+void Timed_lock(pthread_mutex_t* mutex_p, search_stats_t* my_stats) {
+	double start;
+
+	if (pthread_mutex_trylock(mutex_p) == 0)
+		return;
+	if (my_stats == NULL) {
+		pthread_mutex_lock(mutex_p);
+	} else {
+		start = Elapsed();
+		pthread_mutex_lock(mutex_p);
+		my_stats->lock_time += Elapsed() - start;
+	}
+} /* Timed_lock */
+
+/*------------------------------------------------------------------
+ * Function:    Timed_rdlock
+ * Purpose:     Read lock lock_p, timing any wait as Timed_lock does
+ * In/out args: lock_p, my_stats:  NULL for no timing
+ */
+void Timed_rdlock(pthread_rwlock_t* lock_p, search_stats_t* my_stats) {
+	double start;
+
+	if (pthread_rwlock_tryrdlock(lock_p) == 0)
+		return;
+	if (my_stats == NULL) {
+		pthread_rwlock_rdlock(lock_p);
+	} else {
+		start = Elapsed();
+		pthread_rwlock_rdlock(lock_p);
+		my_stats->lock_time += Elapsed() - start;
+	}
+} /* Timed_rdlock */
+
+/*------------------------------------------------------------------
+ * Function:    Timed_wrlock
+ * Purpose:     Write lock lock_p, timing any wait as Timed_lock does
+ * In/out args: lock_p, my_stats:  NULL for no timing
+ */
+void Timed_wrlock(pthread_rwlock_t* lock_p, search_stats_t* my_stats) {
+	double start;
+
+	if (pthread_rwlock_trywrlock(lock_p) == 0)
+		return;
+	if (my_stats == NULL) {
+		pthread_rwlock_wrlock(lock_p);
+	} else {
+		start = Elapsed();
+		pthread_rwlock_wrlock(lock_p);
+		my_stats->lock_time += Elapsed() - start;
+	}
+} /* Timed_wrlock */
+
+/*------------------------------------------------------------------
+ * Function:        Print_balance
+ * Purpose:         Print, on stderr, how each DFS thread spent its time
+ *                  off the bench, and how unevenly the busy time was
+ *                  spread (note 30)
+ * Global vars in:  search_stats, dfs_thread_count
+ */
+void Print_balance(void) {
+	search_stats_t* stats_p;
+	double on, busy, busy_total = 0.0, busy_max = 0.0;
+	int t;
+
+	fprintf(stderr, "balance: thread   busy%%  split%%   idle%%   lock%%  "
+			"benched s\n");
+	for (t = 0; t < dfs_thread_count; t++) {
+		stats_p = &search_stats[t];
+		on = stats_p->run_time - stats_p->bench_time;
+		busy = on - stats_p->split_time - stats_p->wait_time
+				- stats_p->lock_time;
+		busy_total += busy;
+		if (busy > busy_max)
+			busy_max = busy;
+		if (on <= 0.0)
+			on = 1.0; /* Never ran:  all the shares are 0 */
+		fprintf(stderr, "balance: %6d %7.1f %7.2f %7.1f %7.2f %10.3f\n", t,
+				100.0 * busy / on, 100.0 * stats_p->split_time / on,
+				100.0 * stats_p->wait_time / on,
+				100.0 * stats_p->lock_time / on, stats_p->bench_time);
+	}
+	if (busy_total > 0.0)
+		fprintf(stderr, "balance: imbalance %.1f%% (busiest over mean busy "
+				"time, less 1)\n",
+				100.0 * (busy_max * dfs_thread_count / busy_total - 1.0));
+} /* Print_balance */
+
+/*------------------------------------------------------------------
+ * Function:  Start_perf
+ * Purpose:   Open and start the perf_names counters for the calling
+ *            thread, in user space only
+ * Out arg:   my_stats->perf_fds
+ */
+void Start_perf(search_stats_t* my_stats) {
+	const __u32 types[PERF_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+			PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+	const __u64 configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+					| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	struct perf_event_attr attr;
+	int e;
+
+	for (e = 0; e < PERF_EVENTS; e++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = types[e];
+		attr.config = configs[e];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		my_stats->perf_fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+				0);
+		if (my_stats->perf_fds[e] >= 0)
+			ioctl(my_stats->perf_fds[e], PERF_EVENT_IOC_ENABLE, 0);
+		else
+			perf_errno = errno;
+	}
+} /* Start_perf */
+
+/*------------------------------------------------------------------
+ * Function:  Stop_perf
+ * Purpose:   Read and close the counters Start_perf opened
+ * In/out arg:my_stats:  perf_fds in, perf_counts out
+ */
+void Stop_perf(search_stats_t* my_stats) {
+	int e;
+
+	for (e = 0; e < PERF_EVENTS; e++) {
+		if (my_stats->perf_fds[e] < 0)
+			continue;
+		ioctl(my_stats->perf_fds[e], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(my_stats->perf_fds[e], &my_stats->perf_counts[e],
+				sizeof(long long)) != sizeof(long long))
+			my_stats->perf_counts[e] = -1;
+		close(my_stats->perf_fds[e]);
+	}
+} /* Stop_perf */
+
+/*------------------------------------------------------------------
+ * Function:        Print_perf
+ * Purpose:         Print each DFS thread's nodes expanded, IPC, and
+ *                  the other counters per node, on stderr
+ * Global vars in:  search_stats, dfs_thread_count, n
+ */
+void Print_perf(void) {
+	search_stats_t* stats_p;
+	long nodes;
+	int t, d, e, opened = 0;
+
+	fprintf(stderr, "perf: thread      nodes    IPC  L1d/node  LLC/node  "
+			"brmiss/node\n");
+	for (t = 0; t < dfs_thread_count; t++) {
+		stats_p = &search_stats[t];
+		nodes = 0;
+		for (d = 0; d <= n; d++)
+			nodes += stats_p->nodes[d];
+		fprintf(stderr, "perf: %6d %10ld", t, nodes);
+		if (stats_p->perf_fds[0] >= 0 && stats_p->perf_fds[1] >= 0
+				&& stats_p->perf_counts[0] > 0)
+			fprintf(stderr, " %6.2f", (double) stats_p->perf_counts[1]
+					/ stats_p->perf_counts[0]);
+		else
+			fprintf(stderr, " %6s", "-");
+		for (e = 2; e < PERF_EVENTS; e++)
+			if (stats_p->perf_fds[e] >= 0 && stats_p->perf_counts[e] >= 0
+					&& nodes > 0)
+				fprintf(stderr, " %*.3f", e == 4 ? 12 : 9,
+						(double) stats_p->perf_counts[e] / nodes);
+			else
+				fprintf(stderr, " %*s", e == 4 ? 12 : 9, "-");
+		fprintf(stderr, "\n");
+		for (e = 0; e < PERF_EVENTS; e++)
+			opened += stats_p->perf_fds[e] >= 0;
+	}
+	if (opened == 0)
+		fprintf(stderr, "perf: no counters available (%s)\n",
+				strerror(perf_errno));
+} /* Print_perf */
+
+/*------------------------------------------------------------------
+ * Function:        Knuth_probe
+ * Purpose:         Walk one random path down the DFS tree below a
+ *                  partial tour, choosing uniformly among the children
+ *                  Search would push.  The product of the numbers of
+ *                  children seen on the way down is an unbiased
+ *                  estimate of the number of nodes at each depth.
+ * In args:         prefix, count, cost:  the partial tour, its number
+ *                     of cities and its cost
+ *                  l_best_tour:  the incumbent used for pruning
+ * In/out args:     levels:  levels[d] is increased by the estimate of
+ *                     the number of nodes with d cities
+ *                  seed_p:  random number state
+ * Global vars in:  mat, n, bound, min_out, min_out_total
+ * Ret val:         Estimated number of nodes below the partial tour
+ */
+double Knuth_probe(city_t* prefix, int count, weight_t cost, int l_best_tour,
+		double* levels, unsigned* seed_p) {
+	city_t* cand = malloc(n * sizeof(city_t));
+	char* visited = calloc(n, 1);
+	weight_t rest = bound == BOUND_MIN_EDGE ? min_out_total : 0;
+	city_t city = prefix[count - 1], nbr;
+	double prod = 1.0, total = 0.0;
+	int i, d, c;
+
+	for (i = 0; i < count; i++) {
+		visited[prefix[i]] = TRUE;
+		if (bound == BOUND_MIN_EDGE)
+			rest -= min_out[prefix[i]];
+	}
+	for (d = count; d < n; d++) {
+		c = 0;
+		for (nbr = 0; nbr < n; nbr++) /* The root is in prefix */
+			if (!visited[nbr] && cost + rest + mat[n * city + nbr] < l_best_tour)
+				cand[c++] = nbr;
+		if (c == 0)
+			break;
+		prod *= c;
+		levels[d + 1] += prod;
+		total += prod;
+
+		nbr = cand[rand_r(seed_p) % c];
+		cost += mat[n * city + nbr];
+		if (bound == BOUND_MIN_EDGE)
+			rest -= min_out[nbr];
+		visited[nbr] = TRUE;
+		city = nbr;
+	}
+	free(cand);
+	free(visited);
+	return total;
+} /* Knuth_probe */
+
+/*------------------------------------------------------------------
+ * Function:        Estimate_subtree
+ * Purpose:         Estimate the number of DFS nodes below a partial
+ *                  tour, pruned against the current best_tour, by
+ *                  averaging probes Knuth probes
+ * In args:         prefix, count, cost:  as for Knuth_probe
+ *                  probes:  number of probes
+ * Out arg:         levels:  if not NULL, levels[d] is the estimated
+ *                     number of nodes with d cities (n + 1 entries)
+ * In/out arg:      seed_p:  random number state
+ * Global vars in:  n, best_tour
+ * Ret val:         The estimate
+ */
+double Estimate_subtree(city_t* prefix, int count, weight_t cost, int probes,
+		double* levels, unsigned* seed_p) {
+	double* sums = calloc(n + 1, sizeof(double));
+	double total = 0.0;
+	int l_best_tour, p, d;
+
+	pthread_rwlock_rdlock(&best_tour_lock);
+	l_best_tour = best_tour.cost;
+	pthread_rwlock_unlock(&best_tour_lock);
+	for (p = 0; p < probes; p++)
+		total += Knuth_probe(prefix, count, cost, l_best_tour, sums, seed_p);
+	if (levels != NULL)
+		for (d = 0; d <= n; d++)
+			levels[d] = sums[d] / probes;
+	free(sums);
+	return total / probes;
+} /* Estimate_subtree */
+
+/*------------------------------------------------------------------
+ * Function:         Estimate_tree_size
+ * Purpose:          Estimate the size of the whole DFS tree.  The
+ *                   number of nodes at each depth is the number at the
+ *                   depth above times a branching factor:  the one the
+ *                   DFS has observed there if it has expanded at least
+ *                   PROGRESS_MIN_SAMPLES nodes at that depth, and the
+ *                   one from PROGRESS_PROBES Knuth probes otherwise.
+ * Out arg:          done_p:  nodes expanded so far by all DFS threads
+ * In/out arg:       seed_p:  random number state
+ * Global vars in:   n, dfs_thread_count, search_stats, best_tour
+ * Global vars out:  tree_size_estimate
+ * Ret val:          The estimate
+ */
+double Estimate_tree_size(long* done_p, unsigned* seed_p) {
+	double* levels = calloc(n + 1, sizeof(double));
+	double size = 1.0, total = 0.0, branch;
+	long nodes, prunes;
+	city_t root = 0;
+	int l_best_tour, d, p, t;
+
+	pthread_rwlock_rdlock(&best_tour_lock);
+	l_best_tour = best_tour.cost;
+	pthread_rwlock_unlock(&best_tour_lock);
+	for (p = 0; p < PROGRESS_PROBES; p++)
+		Knuth_probe(&root, 1, 0, l_best_tour, levels, seed_p);
+
+	*done_p = 0;
+	for (d = 1; d < n; d++) {
+		nodes = prunes = 0;
+		for (t = 0; t < dfs_thread_count; t++) {
+			nodes += search_stats[t].nodes[d];
+			prunes += search_stats[t].prunes[d];
+			*done_p += search_stats[t].nodes[d + 1];
+		}
+		if (d == 1) /* Search pushes every city after the root */
+			branch = n - 1;
+		else if (nodes >= PROGRESS_MIN_SAMPLES)
+			branch = (double) ((n - d) * nodes - prunes) / nodes;
+		else if (levels[d] > 0.0)
+			branch = levels[d + 1] / levels[d];
+		else
+			branch = 0.0;
+		size *= branch;
+		total += size;
+	}
+	free(levels);
+	tree_size_estimate = total;
+	return total;
+} /* Estimate_tree_size */
+
+/*------------------------------------------------------------------
+ * Function:        Monitor
+ * Purpose:         Print a snapshot whenever SIGUSR1 asks for one, and
+ *                  with -p, every progress_interval seconds, report on
+ *                  stderr how much of the estimated DFS tree has been
+ *                  expanded and the estimated time remaining
+ * Global vars in:  progress_interval, dfs_thread_count, monitor_stop,
+ *                  solve_done
+ * Global vars in/out: snapshot_requested
+ */
+void *Monitor(void* arg) {
+	double next = progress_interval, now, total, rate;
+	unsigned seed = 1;
+	long done;
+
+	while (!monitor_stop && !solve_done) {
+		Monitor_nap(50);
+		if (snapshot_requested) {
+			snapshot_requested = FALSE;
+			Print_snapshot();
+		}
+		now = Elapsed();
+		if (progress_interval <= 0.0 || dfs_thread_count == 0 || now < next)
+			continue;
+		next += progress_interval;
+
+		total = Estimate_tree_size(&done, &seed);
+		rate = done / now;
+		if (done < total && rate > 0.0)
+			fprintf(stderr, "progress: %.1f s, %ld of ~%.3g nodes (%.1f%%), "
+					"ETA %.1f s\n", now, done, total, 100.0 * done / total,
+					(total - done) / rate);
+		else
+			fprintf(stderr, "progress: %.1f s, %ld of ~%.3g nodes, "
+					"finishing\n", now, done, total);
+	}
+	return NULL;
+} /* Monitor */
+
+/*------------------------------------------------------------------
+ * Function:         Init_monitor
+ * Purpose:          Set up monitor_mutex, and monitor_cond on the
+ *                   monotonic clock that Monitor_nap times against
+ * Global vars out:  monitor_mutex, monitor_cond
+ */
+void Init_monitor(void) {
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&monitor_mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&monitor_cond, &attr);
+	pthread_condattr_destroy(&attr);
+} /* Init_monitor */
+
+/*------------------------------------------------------------------
+ * Function:        Monitor_nap
+ * Purpose:         Sleep for ms milliseconds, or until Solve sets
+ *                  monitor_stop, so joining Monitor and Resizer
+ *                  doesn't wait out a nap
+ * In arg:          ms
+ * Global vars in:  monitor_stop
+ */
+void Monitor_nap(long ms) {
+	struct timespec until;
+
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_nsec += ms * 1000000;
+	until.tv_sec += until.tv_nsec / 1000000000;
+	until.tv_nsec %= 1000000000;
+	pthread_mutex_lock(&monitor_mutex);
+	while (!monitor_stop && pthread_cond_timedwait(&monitor_cond,
+			&monitor_mutex, &until) != ETIMEDOUT)
+		;
+	pthread_mutex_unlock(&monitor_mutex);
+} /* Monitor_nap */
+
+/*------------------------------------------------------------------
+ * Function:        Print_snapshot
+ * Purpose:         Print on stderr what each DFS thread last published
+ *                  and the cost of the best tour so far (note 31)
+ * Global vars in:  search_stats, dfs_thread_count, dfs_target, n,
+ *                  best_tour, new_stack_size
+ */
+void Print_snapshot(void) {
+	search_stats_t* stats_p;
+	long nodes, total = 0;
+	weight_t cost;
+	int t, d;
+
+	pthread_rwlock_rdlock(&best_tour_lock);
+	cost = best_tour.cost;
+	pthread_rwlock_unlock(&best_tour_lock);
+	fprintf(stderr, "snapshot: %.1f s, %s engine, best tour ", Elapsed(),
+			engine_names[engine]);
+	if (cost < INFINITY)
+		fprintf(stderr, "%d\n", cost);
+	else
+		fprintf(stderr, "none yet\n");
+	if (dfs_thread_count == 0)
+		return;
+	fprintf(stderr, "snapshot: thread      nodes  depth  stack\n");
+	for (t = 0; t < dfs_thread_count; t++) {
+		stats_p = &search_stats[t];
+		nodes = 0;
+		for (d = 0; d <= n; d++)
+			nodes += stats_p->nodes[d];
+		total += nodes;
+		fprintf(stderr, "snapshot: %6d %10ld %6d %6d%s\n", t, nodes,
+				stats_p->depth, stats_p->stack_size,
+				t >= dfs_target ? "  benched" : "");
+	}
+	fprintf(stderr, "snapshot: %ld nodes in all, %d waiting to be "
+			"claimed\n", total, new_stack_size);
+} /* Print_snapshot */
+
+/*------------------------------------------------------------------
+ * Function:        Nearest_neighbor_tour
+ * Purpose:         Build a tour greedily, starting at city 0 and always
+ *                  moving to the cheapest unvisited city
+ * Out arg:         order:  the n cities in the order they are visited
+ * Global vars in:  mat, n
+ */
+void Nearest_neighbor_tour(city_t* order) {
+	int i, j, best_j;
+	city_t tmp;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = 1; i < n - 1; i++) {
+		best_j = i;
+		for (j = i + 1; j < n; j++)
+			if (mat[n * order[i - 1] + order[j]]
+					< mat[n * order[i - 1] + order[best_j]])
+				best_j = j;
+		tmp = order[i];
+		order[i] = order[best_j];
+		order[best_j] = tmp;
+	}
+} /* Nearest_neighbor_tour */
+
+/*------------------------------------------------------------------
+ * Function:        Tour_cost
+ * Purpose:         Compute the cost of a complete cyclic tour
+ * In arg:          order:  the n cities in the order they are visited
+ * Global vars in:  mat, n
+ * Ret val:         The cost of the tour, including the return edge
+ */
+weight_t Tour_cost(city_t* order) {
+	int i;
+	weight_t cost = mat[n * order[n - 1] + order[0]];
+
+	for (i = 0; i < n - 1; i++)
+		cost += mat[n * order[i] + order[i + 1]];
+	return cost;
+} /* Tour_cost */
+
+/*------------------------------------------------------------------
+ * Function:            Update_best_tour
+ * Purpose:             Publish a complete tour found by a heuristic
+ *                      engine if it is better than best_tour.  The tour
+ *                      is rotated so that it starts and ends at city 0,
+ *                      as the exact search reports it.
+ * In args:             order:  the n cities in the order they are visited
+ *                      cost:   the cost of the tour
+ * Global vars in:      n
+ * Global vars in/out:  best_tour
+ */
+void Update_best_tour(city_t* order, weight_t cost) {
+	int i, start;
+
+	pthread_rwlock_rdlock(&best_tour_lock);
+	if (cost >= best_tour.cost) {
+		pthread_rwlock_unlock(&best_tour_lock);
+		return;
+	}
+	pthread_rwlock_unlock(&best_tour_lock);
+
+	for (start = 0; order[start] != 0; start++)
+		;
+	pthread_rwlock_wrlock(&best_tour_lock);
+	if (cost < best_tour.cost) {
+		for (i = 0; i < n; i++)
+			best_tour.cities[i] = order[(start + i) % n];
+		best_tour.cities[n] = 0;
+		best_tour.count = n + 1;
+		best_tour.cost = cost;
+	}
+	pthread_rwlock_unlock(&best_tour_lock);
+} /* Update_best_tour */
+
+/*------------------------------------------------------------------
+ * Function:         Setup_anneal
+ * Purpose:          Start every chain from the nearest neighbour tour
+ *                   and spread the chain temperatures geometrically
+ *                   between ANNEAL_T_LOW and ANNEAL_T_HIGH times the
+ *                   mean edge cost.  Chain 0 is the coldest.
+ * Global vars in:   mat, n, heur_thread_count
+ * Global vars out:  anneal_tours, anneal_costs, anneal_temps,
+ *                   anneal_barrier
+ */
+void Setup_anneal(void) {
+	int i, j;
+	double mean = 0.0, t_low, t_high;
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			mean += mat[n * i + j];
+	mean /= (double) n * (n - 1);
+	t_low = ANNEAL_T_LOW * mean;
+	t_high = ANNEAL_T_HIGH * mean;
+
+	anneal_tours = malloc(heur_thread_count * sizeof(city_t*));
+	anneal_costs = malloc(heur_thread_count * sizeof(weight_t));
+	anneal_temps = malloc(heur_thread_count * sizeof(double));
+	for (i = 0; i < heur_thread_count; i++) {
+		anneal_tours[i] = malloc(n * sizeof(city_t));
+		Nearest_neighbor_tour(anneal_tours[i]);
+		anneal_costs[i] = Tour_cost(anneal_tours[i]);
+		if (heur_thread_count == 1)
+			anneal_temps[i] = t_low;
+		else
+			anneal_temps[i] = t_low
+					* pow(t_high / t_low, (double) i / (heur_thread_count - 1));
+	}
+	Update_best_tour(anneal_tours[0], anneal_costs[0]);
+	pthread_barrier_init(&anneal_barrier, NULL, heur_thread_count);
+} /* Setup_anneal */
+
+/*------------------------------------------------------------------
+ * Function:         Free_anneal
+ * Purpose:          Release the storage used by the anneal engine
+ * Global vars out:  anneal_tours, anneal_costs, anneal_temps,
+ *                   anneal_barrier
+ */
+void Free_anneal(void) {
+	int i;
+
+	for (i = 0; i < heur_thread_count; i++)
+		free(anneal_tours[i]);
+	free(anneal_tours);
+	free(anneal_costs);
+	free(anneal_temps);
+	pthread_barrier_destroy(&anneal_barrier);
+} /* Free_anneal */
+
+/*------------------------------------------------------------------
+ * Function:            Anneal
+ * Purpose:             Run one simulated annealing chain at a fixed
+ *                      temperature.  After each sweep of ANNEAL_SWEEP * n
+ *                      moves the chains meet at a barrier, thread 0
+ *                      offers exchanges between neighbouring
+ *                      temperatures, and each thread continues with
+ *                      whichever tour is now in its slot.
+ * In arg:              rank
+ * Global vars in:      mat, n, anneal_temps
+ * Global vars in/out:  anneal_tours, anneal_costs, best_tour
+ */
+void *Anneal(void* rank) {
+	long my_rank = (long) rank;
+	unsigned seed = 1 + my_rank;
+	double temp = anneal_temps[my_rank];
+	city_t* order;
+	city_t* my_best = malloc(n * sizeof(city_t));
+	weight_t cost, delta, my_best_cost = INFINITY, published = INFINITY;
+	long move, moves = (long) ANNEAL_SWEEP * n;
+	int round, len, i, j, k;
+
+	for (round = 0; round < ANNEAL_ROUNDS; round++) {
+		order = anneal_tours[my_rank];
+		cost = anneal_costs[my_rank];
+		for (move = 0; move < moves; move++) {
+			len = 1 + rand_r(&seed) % ANNEAL_MAX_SEG;
+			i = rand_r(&seed) % (n - len + 1);
+			j = i + len - 1;
+			k = rand_r(&seed) % n;
+			/* k must not be in the segment or just before it */
+			if ((k >= i - 1 && k <= j) || (i == 0 && k == n - 1))
+				continue;
+			delta = Or_opt_delta(order, i, j, k);
+			if (delta <= 0 || exp(-delta / temp) * RAND_MAX
+					> rand_r(&seed)) {
+				Or_opt_apply(order, i, j, k);
+				cost += delta;
+				if (cost < my_best_cost) {
+					my_best_cost = cost;
+					memcpy(my_best, order, n * sizeof(city_t));
+				}
+			}
+		}
+		anneal_costs[my_rank] = cost;
+		if (my_best_cost < published) {
+			Update_best_tour(my_best, my_best_cost);
+			published = my_best_cost;
+		}
+
+		pthread_barrier_wait(&anneal_barrier);
+		if (my_rank == 0) {
+			Exchange_replicas(round, &seed);
+			heur_stop = Stop_requested();
+		}
+		pthread_barrier_wait(&anneal_barrier);
+		if (heur_stop)
+			break;
+	}
+
+	free(my_best);
+	return NULL;
+} /* Anneal */
+
+/*------------------------------------------------------------------
+ * Function:        Or_opt_delta
+ * Purpose:         Compute the change in cost from moving the segment
+ *                  order[i..j] so that it lies between order[k] and
+ *                  order[k+1] (cyclically) without reversing it
+ * In args:         All.  0 <= i <= j < n, and k is neither in the
+ *                  segment nor the city just before it.
+ * Global vars in:  mat, n
+ * Ret val:         The new tour cost minus the old tour cost
+ */
+weight_t Or_opt_delta(city_t* order, int i, int j, int k) {
+	city_t a = order[(i + n - 1) % n], s1 = order[i];
+	city_t s2 = order[j], b = order[(j + 1) % n];
+	city_t c = order[k], d = order[(k + 1) % n];
+
+	return mat[n * a + b] + mat[n * c + s1] + mat[n * s2 + d]
+			- mat[n * a + s1] - mat[n * s2 + b] - mat[n * c + d];
+} /* Or_opt_delta */
+
+/*------------------------------------------------------------------
+ * Function:    Or_opt_apply
+ * Purpose:     Move the segment order[i..j] so that it lies between
+ *              order[k] and order[k+1], shifting the cities in between
+ * In args:     i, j, k:  as for Or_opt_delta
+ * In/out arg:  order
+ */
+void Or_opt_apply(city_t* order, int i, int j, int k) {
+	city_t seg[ANNEAL_MAX_SEG];
+	int len = j - i + 1;
+
+	memcpy(seg, &order[i], len * sizeof(city_t));
+	if (k > j) {
+		memmove(&order[i], &order[j + 1], (k - j) * sizeof(city_t));
+		memcpy(&order[k - len + 1], seg, len * sizeof(city_t));
+	} else {
+		memmove(&order[k + 1 + len], &order[k + 1],
+				(i - k - 1) * sizeof(city_t));
+		memcpy(&order[k + 1], seg, len * sizeof(city_t));
+	}
+} /* Or_opt_apply */
+
+/*------------------------------------------------------------------
+ * Function:            Exchange_replicas
+ * Purpose:             Offer to swap the tours of neighbouring chains,
+ *                      pairing (0,1), (2,3), ... on even rounds and
+ *                      (1,2), (3,4), ... on odd rounds.  A swap is
+ *                      accepted with probability
+ *                      min(1, exp((E_i - E_j)(1/T_i - 1/T_j))).
+ *                      Only called by thread 0 while the others wait.
+ * In arg:              round
+ * In/out arg:          seed_p:  thread 0's random number state
+ * Global vars in:      heur_thread_count, anneal_temps
+ * Global vars in/out:  anneal_tours, anneal_costs
+ */
+void Exchange_replicas(int round, unsigned* seed_p) {
+	int i;
+	double x;
+	city_t* tmp_tour;
+	weight_t tmp_cost;
+
+	for (i = round % 2; i + 1 < heur_thread_count; i += 2) {
+		x = (anneal_costs[i] - anneal_costs[i + 1])
+				* (1.0 / anneal_temps[i] - 1.0 / anneal_temps[i + 1]);
+		if (x >= 0 || exp(x) * RAND_MAX > rand_r(seed_p)) {
+			tmp_tour = anneal_tours[i];
+			anneal_tours[i] = anneal_tours[i + 1];
+			anneal_tours[i + 1] = tmp_tour;
+			tmp_cost = anneal_costs[i];
+			anneal_costs[i] = anneal_costs[i + 1];
+			anneal_costs[i + 1] = tmp_cost;
+		}
+	}
+} /* Exchange_replicas */
+
+/*------------------------------------------------------------------
+ * Function:         Build_nbr_lists
+ * Purpose:          For each city, list its count cheapest successors
+ *                   in increasing order of cost
+ * In arg:           count:  requested list length (at most n - 1 used)
+ * Global vars in:   mat, n
+ * Global vars out:  nbr_lists, nbr_count
+ */
+void Build_nbr_lists(int count) {
+	int i;
+	city_t* row = malloc(n * sizeof(city_t));
+
+	nbr_count = count < n - 1 ? count : n - 1;
+	free(nbr_lists);
+	nbr_lists = malloc(n * nbr_count * sizeof(city_t));
+	for (i = 0; i < n; i++)
+		Build_nbr_row(i, row);
+	free(row);
+} /* Build_nbr_lists */
+
+/*------------------------------------------------------------------
+ * Function:            Build_nbr_row
+ * Purpose:             Fill in the neighbour list of one city by a
+ *                      partial selection sort of the n - 1 others
+ * In arg:              i
+ * Scratch:             row:  room for n - 1 cities
+ * Global vars in:      mat, n, nbr_count
+ * Global vars in/out:  nbr_lists
+ */
+void Build_nbr_row(city_t i, city_t* row) {
+	int j, r, best_j;
+
+	for (j = 0; j < n - 1; j++)
+		row[j] = j < i ? j : j + 1;
+	for (r = 0; r < nbr_count; r++) {
+		best_j = r;
+		for (j = r + 1; j < n - 1; j++)
+			if (mat[n * i + row[j]] < mat[n * i + row[best_j]])
+				best_j = j;
+		nbr_lists[nbr_count * i + r] = row[best_j];
+		row[best_j] = row[r];
+	}
+} /* Build_nbr_row */
+
+/*------------------------------------------------------------------
+ * Function:        Or_opt_local_search
+ * Purpose:         Apply improving Or-opt moves until none is left.
+ *                  Only moves that make the end of the segment point
+ *                  at one of its nbr_lists successors are tried.
+ * In/out args:     order:   the n cities of a complete tour
+ *                  cost_p:  the cost of the tour
+ * Global vars in:  mat, n, nbr_lists, nbr_count
+ */
+void Or_opt_local_search(city_t* order, weight_t* cost_p) {
+	int* pos = malloc(n * sizeof(int));
+	int improved = TRUE;
+	int i, j, k, r, lo, hi;
+	weight_t delta;
+
+	for (i = 0; i < n; i++)
+		pos[order[i]] = i;
+	while (improved) {
+		improved = FALSE;
+		for (i = 0; i < n; i++)
+			for (j = i; j < n && j < i + ANNEAL_MAX_SEG; j++)
+				for (r = 0; r < nbr_count; r++) {
+					k = (pos[nbr_lists[nbr_count * order[j] + r]] + n - 1) % n;
+					if ((k >= i - 1 && k <= j) || (i == 0 && k == n - 1))
+						continue;
+					delta = Or_opt_delta(order, i, j, k);
+					if (delta < 0) {
+						Or_opt_apply(order, i, j, k);
+						*cost_p += delta;
+						lo = k < i ? k + 1 : i;
+						hi = k < i ? j : k;
+						for (; lo <= hi; lo++)
+							pos[order[lo]] = lo;
+						improved = TRUE;
+						break;
+					}
+				}
+	}
+	free(pos);
+} /* Or_opt_local_search */
+
+/*------------------------------------------------------------------
+ * Function:         Setup_aco
+ * Purpose:          Build the candidate lists and start every edge at
+ *                   tau_max computed from the nearest neighbour tour
+ * Global vars in:   mat, n, heur_thread_count
+ * Global vars out:  nbr_lists, pher, tau_min, tau_max, aco_tours,
+ *                   aco_costs, aco_barrier
+ */
+void Setup_aco(void) {
+	int i;
+	city_t* order = malloc(n * sizeof(city_t));
+
+	if (nbr_lists == NULL) /* Else kept current by Apply_delta */
+		Build_nbr_lists(ACO_CAND);
+	Nearest_neighbor_tour(order);
+	Update_best_tour(order, Tour_cost(order));
+	tau_max = 1.0 / (ACO_RHO * Tour_cost(order));
+	tau_min = tau_max / (2.0 * n);
+	free(order);
+
+	pher = malloc(n * n * sizeof(double));
+	for (i = 0; i < n * n; i++)
+		pher[i] = tau_max;
+	aco_tours = malloc(heur_thread_count * sizeof(city_t*));
+	aco_costs = malloc(heur_thread_count * sizeof(weight_t));
+	for (i = 0; i < heur_thread_count; i++)
+		aco_tours[i] = malloc(n * sizeof(city_t));
+	pthread_barrier_init(&aco_barrier, NULL, heur_thread_count);
+} /* Setup_aco */
+
+/*------------------------------------------------------------------
+ * Function:         Free_aco
+ * Purpose:          Release the storage used by the aco engine
+ * Global vars out:  pher, aco_tours, aco_costs, aco_barrier
+ */
+void Free_aco(void) {
+	int i;
+
+	for (i = 0; i < heur_thread_count; i++)
+		free(aco_tours[i]);
+	free(aco_tours);
+	free(aco_costs);
+	free(pher);
+	pthread_barrier_destroy(&aco_barrier);
+} /* Free_aco */
+
+/*------------------------------------------------------------------
+ * Function:            Ant_colony
+ * Purpose:             Run this thread's share of the ants for
+ *                      ACO_ITERATIONS iterations.  Each iteration the
+ *                      thread's best ant is polished and published, the
+ *                      threads evaporate disjoint rows of pher, and
+ *                      thread 0 makes the deposit.
+ * In arg:              rank
+ * Global vars in:      mat, n, heur_thread_count
+ * Global vars in/out:  pher, aco_tours, aco_costs, best_tour
+ */
+void *Ant_colony(void* rank) {
+	long my_rank = (long) rank;
+	unsigned seed = 1 + my_rank;
+	int ants = ACO_ANTS / heur_thread_count > 0 ? ACO_ANTS / heur_thread_count : 1;
+	city_t* order = malloc(n * sizeof(city_t));
+	char* visited = malloc(n);
+	weight_t cost;
+	int iter, ant, i, j;
+
+	for (iter = 0; iter < ACO_ITERATIONS; iter++) {
+		aco_costs[my_rank] = INFINITY;
+		for (ant = 0; ant < ants; ant++) {
+			Construct_ant_tour(order, visited, &seed);
+			cost = Tour_cost(order);
+			if (cost < aco_costs[my_rank]) {
+				aco_costs[my_rank] = cost;
+				memcpy(aco_tours[my_rank], order, n * sizeof(city_t));
+			}
+		}
+		Or_opt_local_search(aco_tours[my_rank], &aco_costs[my_rank]);
+		Update_best_tour(aco_tours[my_rank], aco_costs[my_rank]);
+		pthread_barrier_wait(&aco_barrier);
+
+		for (i = my_rank * n; i < n * n; i += heur_thread_count * n)
+			for (j = i; j < i + n; j++) {
+				pher[j] *= 1.0 - ACO_RHO;
+				if (pher[j] < tau_min)
+					pher[j] = tau_min;
+			}
+		pthread_barrier_wait(&aco_barrier);
+
+		if (my_rank == 0) {
+			Update_pheromone(iter);
+			heur_stop = Stop_requested();
+		}
+		pthread_barrier_wait(&aco_barrier);
+		if (heur_stop)
+			break;
+	}
+
+	free(order);
+	free(visited);
+	return NULL;
+} /* Ant_colony */
+
+/*------------------------------------------------------------------
+ * Function:        Construct_ant_tour
+ * Purpose:         Build one ant's tour from a random start.  The next
+ *                  city is drawn from the unvisited candidates of the
+ *                  current city with probability proportional to
+ *                  pher / cost^2.  If every candidate has been visited,
+ *                  the unvisited city maximizing that weight is taken.
+ * Out args:        order:    the n cities in the order visited
+ *                  visited:  scratch, n flags
+ * In/out arg:      seed_p:   the thread's random number state
+ * Global vars in:  mat, n, pher, nbr_lists, nbr_count
+ */
+void Construct_ant_tour(city_t* order, char* visited, unsigned* seed_p) {
+	int step, r;
+	city_t cur, nbr, pick;
+	double w[ACO_CAND], sum, x, best_w;
+	weight_t c;
+
+	memset(visited, FALSE, n);
+	order[0] = rand_r(seed_p) % n;
+	visited[order[0]] = TRUE;
+	for (step = 1; step < n; step++) {
+		cur = order[step - 1];
+		sum = 0.0;
+		for (r = 0; r < nbr_count; r++) {
+			nbr = nbr_lists[nbr_count * cur + r];
+			c = mat[n * cur + nbr] > 0 ? mat[n * cur + nbr] : 1;
+			w[r] = visited[nbr] ? 0.0 : pher[n * cur + nbr] / ((double) c * c);
+			sum += w[r];
+		}
+		pick = NO_CITY;
+		if (sum > 0.0) {
+			x = sum * rand_r(seed_p) / (RAND_MAX + 1.0);
+			for (r = 0; r < nbr_count; r++) {
+				if (w[r] > 0.0)
+					pick = nbr_lists[nbr_count * cur + r];
+				x -= w[r];
+				if (x < 0.0 && pick != NO_CITY)
+					break;
+			}
+		} else {
+			best_w = -1.0;
+			for (nbr = 0; nbr < n; nbr++) {
+				if (visited[nbr])
+					continue;
+				c = mat[n * cur + nbr] > 0 ? mat[n * cur + nbr] : 1;
+				x = pher[n * cur + nbr] / ((double) c * c);
+				if (x > best_w) {
+					best_w = x;
+					pick = nbr;
+				}
+			}
+		}
+		order[step] = pick;
+		visited[pick] = TRUE;
+	}
+} /* Construct_ant_tour */
+
+/*------------------------------------------------------------------
+ * Function:            Update_pheromone
+ * Purpose:             Deposit 1/cost along the best tour of this
+ *                      iteration, or along best_tour every
+ *                      ACO_GLOBAL_FREQ iterations, and refresh the
+ *                      MAX-MIN limits from best_tour's cost.  Only
+ *                      called by thread 0 while the others wait.
+ * In arg:              iter
+ * Global vars in:      n, heur_thread_count, aco_tours, aco_costs, best_tour
+ * Global vars in/out:  pher, tau_min, tau_max
+ */
+void Update_pheromone(int iter) {
+	int i, best = 0;
+	city_t* order;
+	weight_t cost;
+	double amount;
+
+	for (i = 1; i < heur_thread_count; i++)
+		if (aco_costs[i] < aco_costs[best])
+			best = i;
+	order = aco_tours[best];
+	cost = aco_costs[best];
+
+	pthread_rwlock_rdlock(&best_tour_lock);
+	tau_max = 1.0 / (ACO_RHO * best_tour.cost);
+	if (iter % ACO_GLOBAL_FREQ == ACO_GLOBAL_FREQ - 1) {
+		memcpy(order, best_tour.cities, n * sizeof(city_t));
+		cost = best_tour.cost;
+	}
+	pthread_rwlock_unlock(&best_tour_lock);
+	tau_min = tau_max / (2.0 * n);
+
+	amount = 1.0 / cost;
+	for (i = 0; i < n; i++) {
+		pher[n * order[i] + order[(i + 1) % n]] += amount;
+		if (pher[n * order[i] + order[(i + 1) % n]] > tau_max)
+			pher[n * order[i] + order[(i + 1) % n]] = tau_max;
+	}
+} /* Update_pheromone */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_max_n
+ * Purpose:         Largest instance Held-Karp is used for
+ * Global vars in:  hk_dir
+ */
+int Hk_max_n(void) {
+	return hk_dir == NULL ? HK_MAX_N : HK_MAX_OOC_N;
+} /* Hk_max_n */
+
+/*------------------------------------------------------------------
+ * Function:         Setup_hk
+ * Purpose:          Tabulate the binomial coefficients used to rank
+ *                   subsets, transpose mat and pick the min-plus kernel
+ * Global vars in:   mat, n, hk_thread_count
+ * Global vars out:  hk_binom, hk_mat_t, hk_set, hk_layer,
+ *                   hk_parent, hk_barrier
+ */
+void Setup_hk(void) {
+	int i, j;
+
+	hk_mat_t = malloc(n * n * sizeof(weight_t));
+	for (i = 0; i < n; i++)
+		for (j = 0; j < n; j++)
+			hk_mat_t[n * j + i] = mat[n * i + j];
+	hk_set = Hk_set_scalar;
+#	if defined(__x86_64__) && !defined(HK_SCALAR)
+	if (__builtin_cpu_supports("avx512f"))
+		hk_set = Hk_set_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		hk_set = Hk_set_avx2;
+#	endif
+
+	for (i = 0; i < HK_MAX_OOC_N; i++) {
+		hk_binom[i][0] = 1;
+		for (j = 1; j <= i; j++)
+			hk_binom[i][j] = hk_binom[i - 1][j - 1]
+					+ (j < i ? hk_binom[i - 1][j] : 0);
+		for (; j < HK_MAX_OOC_N; j++)
+			hk_binom[i][j] = 0;
+	}
+	hk_layer[0] = hk_layer[1] = NULL;
+	for (i = 0; i < HK_MAX_OOC_N; i++)
+		hk_parent[i] = NULL;
+	pthread_barrier_init(&hk_barrier, NULL, hk_thread_count);
+} /* Setup_hk */
+
+/*------------------------------------------------------------------
+ * Function:         Free_hk
+ * Purpose:          Unmap whatever layers are still mapped
+ * Global vars in:   n
+ * Global vars out:  hk_mat_t, hk_layer, hk_parent, hk_barrier
+ */
+void Free_hk(void) {
+	int s;
+
+	free(hk_mat_t);
+	for (s = 0; s < 2; s++)
+		if (hk_layer[s] != NULL)
+			munmap(hk_layer[s], hk_layer_bytes[s]);
+	for (s = 1; s < n; s++)
+		if (hk_parent[s] != NULL)
+			munmap(hk_parent[s], hk_binom[n - 1][s] * s);
+	pthread_barrier_destroy(&hk_barrier);
+} /* Free_hk */
+
+/*------------------------------------------------------------------
+ * Function:         Hk_map
+ * Purpose:          Get zeroed storage for a layer.  With -H it is a
+ *                   file in hk_dir, unlinked at once so that it goes
+ *                   away when unmapped or if the program dies.
+ * In arg:           bytes
+ * Global vars in:   hk_dir
+ * Ret val:          The mapping.  Exits if it can't be made.
+ */
+void* Hk_map(size_t bytes) {
+	char* path;
+	void* p;
+	int fd;
+
+	if (hk_dir == NULL) {
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	} else {
+		path = malloc(strlen(hk_dir) + 16);
+		sprintf(path, "%s/hk_XXXXXX", hk_dir);
+		fd = mkstemp(path);
+		if (fd < 0 || unlink(path) != 0 || ftruncate(fd, bytes) != 0) {
+			fprintf(stderr, "Can't create layer file in %s\n", hk_dir);
+			exit(1);
+		}
+		p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		free(path);
+	}
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Can't map %lu bytes for Held-Karp\n",
+				(unsigned long) bytes);
+		exit(1);
+	}
+	return p;
+} /* Hk_map */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_rank
+ * Purpose:         Position of a subset among the subsets of the same
+ *                  size in colex order (the order Gosper's hack
+ *                  visits them):  sum of C(c_i, i+1) over its members
+ *                  c_0 < c_1 < ...
+ * In arg:          set
+ * Global vars in:  hk_binom
+ * Ret val:         The rank
+ */
+unsigned long Hk_rank(unsigned long set) {
+	unsigned long rank = 0;
+	int i;
+
+	for (i = 1; set != 0; i++, set &= set - 1)
+		rank += hk_binom[__builtin_ctzl(set)][i];
+	return rank;
+} /* Hk_rank */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_unrank
+ * Purpose:         Inverse of Hk_rank
+ * In args:         rank, s:  the rank and the size of the subset
+ * Global vars in:  n, hk_binom
+ * Ret val:         The subset
+ */
+unsigned long Hk_unrank(unsigned long rank, int s) {
+	unsigned long set = 0;
+	int c = n - 2;
+
+	for (; s > 0; s--) {
+		while (hk_binom[c][s] > rank)
+			c--;
+		set |= 1UL << c;
+		rank -= hk_binom[c][s];
+		c--;
+	}
+	return set;
+} /* Hk_unrank */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_fill
+ * Purpose:         Compute the entries of layer s for subsets with
+ *                  ranks first <= rank < last.  The entries of a
+ *                  subset are stored in the order of its members, and
+ *                  the member of S \ {j} giving the minimum is kept as
+ *                  the parent record.  The minima themselves are
+ *                  taken by the hk_set kernel.
+ * In args:         s, first, last
+ * Global vars in:  hk_binom, hk_set, hk_layer[(s - 1) % 2]
+ * Global vars out: hk_layer[s % 2], hk_parent[s]
+ */
+void Hk_fill(int s, unsigned long first, unsigned long last) {
+	weight_t* prev_layer = hk_layer[(s - 1) % 2];
+	weight_t* rows[HK_MAX_OOC_N], *out = hk_layer[s % 2] + first * s;
+	unsigned char* par = hk_parent[s] + first * s;
+	unsigned long set = Hk_unrank(first, s), rank, low, ripple;
+	unsigned long below[HK_MAX_OOC_N + 1], above[HK_MAX_OOC_N + 1];
+	int c[HK_MAX_OOC_N]; /* Members of S, plus one to index mat */
+	int i, q;
+
+	for (rank = first; rank < last; rank++) {
+		for (low = set, i = 0; low != 0; low &= low - 1, i++)
+			c[i] = __builtin_ctzl(low) + 1;
+		/* Removing member q moves the members above it down a place */
+		below[0] = 0;
+		for (i = 0; i < s; i++)
+			below[i + 1] = below[i] + hk_binom[c[i] - 1][i + 1];
+		above[s] = 0;
+		for (i = s - 1; i > 0; i--)
+			above[i] = above[i + 1] + hk_binom[c[i] - 1][i];
+
+		for (q = 0; q < s; q++)
+			rows[q] = prev_layer + (below[q] + above[q + 1]) * (s - 1);
+		hk_set(s, c, rows, out, par);
+		out += s;
+		par += s;
+
+		/* Next subset of the same size */
+		low = set & -set;
+		ripple = set + low;
+		set = (((ripple ^ set) >> 2) / low) | ripple;
+	}
+} /* Hk_fill */
+
+/*------------------------------------------------------------------
+ * Function:            Held_karp
+ * Purpose:             Compute the Held-Karp table one subset size at
+ *                      a time.  Only the previous layer is needed to
+ *                      compute the next, so just two are kept, plus a
+ *                      byte per entry recording its parent.  Each
+ *                      layer is cut into chunks of HK_CHUNK subsets,
+ *                      which the threads claim with a fetch-and-add and
+ *                      write sequentially.  Thread 0 sets up each
+ *                      layer between two barriers and at the end
+ *                      publishes the optimal tour and stops the other
+ *                      engines.
+ * In arg:              rank
+ * Global vars in:      mat, n, hk_thread_count, solve_done
+ * Global vars in/out:  hk_layer, hk_parent, hk_next_chunk, best_tour
+ */
+void *Held_karp(void* rank) {
+	int m = n - 1, s, j;
+	unsigned long chunk, first, last;
+	weight_t cost;
+	city_t* order;
+
+	for (s = 1; s <= m; s++) {
+		if (pthread_barrier_wait(&hk_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			if (hk_layer[s % 2] != NULL)
+				munmap(hk_layer[s % 2], hk_layer_bytes[s % 2]);
+			hk_layer_bytes[s % 2] = hk_binom[m][s] * s * sizeof(weight_t);
+			hk_layer[s % 2] = Hk_map(hk_layer_bytes[s % 2]);
+			hk_parent[s] = Hk_map(hk_binom[m][s] * s);
+			madvise(hk_layer[s % 2], hk_layer_bytes[s % 2], MADV_SEQUENTIAL);
+			if (s == 1) /* The path from 0 straight to j */
+				for (j = 0; j < m; j++)
+					hk_layer[1][j] = mat[j + 1];
+			hk_next_chunk = 0;
+			hk_stop = Stop_requested();
+		}
+		pthread_barrier_wait(&hk_barrier);
+		if (hk_stop)
+			return NULL;
+		if (s == 1)
+			continue;
+
+		while ((chunk = __atomic_fetch_add(&hk_next_chunk, 1, __ATOMIC_RELAXED))
+				* HK_CHUNK < hk_binom[m][s]) {
+			first = chunk * HK_CHUNK;
+			last = first + HK_CHUNK < hk_binom[m][s] ?
+					first + HK_CHUNK : hk_binom[m][s];
+			Hk_fill(s, first, last);
+		}
+	}
+
+	if (pthread_barrier_wait(&hk_barrier) == PTHREAD_BARRIER_SERIAL_THREAD
+			&& !solve_done) {
+		order = malloc(n * sizeof(city_t));
+		Hk_tour(order, &cost);
+		Update_best_tour(order, cost);
+		free(order);
+		solve_complete = TRUE;
+		Finish_search();
+	}
+	return NULL;
+} /* Held_karp */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_tour
+ * Purpose:         Follow the parent records back from the full set
+ *                  to read out the optimal tour
+ * Out args:        order:   the n cities of the tour, starting at 0
+ *                  cost_p:  its cost
+ * Global vars in:  mat, n, hk_layer[(n - 1) % 2], hk_parent
+ */
+void Hk_tour(city_t* order, weight_t* cost_p) {
+	int m = n - 1, j, q, s, best_j = 0;
+	unsigned long set = (1UL << m) - 1;
+
+	order[0] = 0;
+	if (m == 0) { /* A single city:  there is no table to read */
+		*cost_p = mat[0];
+		return;
+	}
+	/* The full set is the only subset in the last layer */
+	*cost_p = INFINITY;
+	for (j = 0; j < m; j++)
+		if (hk_layer[m % 2][j] + mat[n * (j + 1)] < *cost_p) {
+			*cost_p = hk_layer[m % 2][j] + mat[n * (j + 1)];
+			best_j = j;
+		}
+
+	j = best_j;
+	for (s = m; s > 1; s--) {
+		order[s] = j + 1;
+		q = __builtin_popcountl(set & ((1UL << j) - 1));
+		j = hk_parent[s][Hk_rank(set) * s + q];
+		set &= ~(1UL << (order[s] - 1));
+	}
+	order[1] = j + 1;
+} /* Hk_tour */
+
+/*------------------------------------------------------------------
+ * Function:        Hk_set_scalar
+ * Purpose:         Min-plus kernel for the entries of one subset S:
+ *                  for each member c[q], the minimum over the other
+ *                  members c[i] of the entry for c[i] in the row of
+ *                  S \ {c[q]}, plus the cost of going from c[i] to
+ *                  c[q].  Row q lists S \ {c[q]} in order, so member
+ *                  i is at i for i < q and at i - 1 for i > q.
+ * In args:         s:     the size of S
+ *                  c:     its members, each plus one
+ *                  rows:  rows[q] is the row of S \ {c[q]}
+ * Out args:        out:   the s entries for S
+ *                  par:   their parent records
+ * Global vars in:  n, hk_mat_t
+ */
+void Hk_set_scalar(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par) {
+	const weight_t* col;
+	weight_t best, val;
+	int q, i, best_i;
+
+	for (q = 0; q < s; q++) {
+		col = hk_mat_t + n * c[q];
+		best = INFINITY;
+		best_i = 0;
+		for (i = 0; i < s; i++) {
+			if (i == q)
+				continue;
+			val = rows[q][i < q ? i : i - 1] + col[c[i]];
+			if (val < best) {
+				best = val;
+				best_i = i;
+			}
+		}
+		out[q] = best;
+		par[q] = c[best_i] - 1;
+	}
+} /* Hk_set_scalar */
+
+#if defined(__x86_64__) && !defined(HK_SCALAR)
+/*------------------------------------------------------------------
+ * Function:   Hk_set_avx2
+ * Purpose:    Hk_set_scalar with lane i of a vector handling member i.
+ *             Lanes below q load from rows[q] and lanes above it from
+ *             rows[q] - 1, the costs are gathered from the transposed
+ *             matrix, and the minimum is reduced across the lanes.
+ */
+__attribute__((target("avx2")))
+void Hk_set_avx2(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par) {
+	const __m256i inf = _mm256_set1_epi32(INFINITY);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i idx, below, above, used, val, min;
+	const weight_t* col;
+	weight_t best, m;
+	int q, g, best_i, bits;
+
+	for (q = 0; q < s; q++) {
+		col = hk_mat_t + n * c[q];
+		best = INFINITY;
+		best_i = 0;
+		for (g = 0; g < s; g += 8) {
+			idx = _mm256_add_epi32(lanes, _mm256_set1_epi32(g));
+			below = _mm256_cmpgt_epi32(_mm256_set1_epi32(q), idx);
+			above = _mm256_and_si256(
+					_mm256_cmpgt_epi32(idx, _mm256_set1_epi32(q)),
+					_mm256_cmpgt_epi32(_mm256_set1_epi32(s), idx));
+			used = _mm256_or_si256(below, above);
+			val = _mm256_or_si256(_mm256_maskload_epi32(rows[q] + g, below),
+					_mm256_maskload_epi32(rows[q] + g - 1, above));
+			val = _mm256_add_epi32(val, _mm256_mask_i32gather_epi32(inf, col,
+					_mm256_maskload_epi32(c + g, used), used, 4));
+			val = _mm256_blendv_epi8(inf, val, used);
+
+			min = _mm256_min_epi32(val, _mm256_permute2x128_si256(val, val, 1));
+			min = _mm256_min_epi32(min, _mm256_shuffle_epi32(min, 0x4E));
+			min = _mm256_min_epi32(min, _mm256_shuffle_epi32(min, 0xB1));
+			m = _mm256_extract_epi32(min, 0);
+			if (m < best) {
+				best = m;
+				bits = _mm256_movemask_ps(_mm256_castsi256_ps(
+						_mm256_cmpeq_epi32(val, min)));
+				best_i = g + __builtin_ctz(bits);
+			}
+		}
+		out[q] = best;
+		par[q] = c[best_i] - 1;
+	}
+} /* Hk_set_avx2 */
+
+/*------------------------------------------------------------------
+ * Function:   Hk_set_avx512
+ * Purpose:    Hk_set_avx2 with sixteen lanes and mask registers
+ */
+__attribute__((target("avx512f")))
+void Hk_set_avx512(int s, const int* c, weight_t** rows, weight_t* out,
+		unsigned char* par) {
+	const __m512i inf = _mm512_set1_epi32(INFINITY);
+	__mmask16 below, above, used;
+	__m512i val;
+	const weight_t* col;
+	weight_t best, m;
+	int q, g, best_i;
+
+	for (q = 0; q < s; q++) {
+		col = hk_mat_t + n * c[q];
+		best = INFINITY;
+		best_i = 0;
+		for (g = 0; g < s; g += 16) {
+			/* Lanes g + l with l < q - g, and with q - g < l < s - g */
+			below = q - g >= 16 ? 0xFFFF : (q > g ? (1U << (q - g)) - 1 : 0);
+			used = s - g >= 16 ? 0xFFFF : (1U << (s - g)) - 1;
+			above = used & ~below & (q >= g && q - g < 16 ?
+					~(1U << (q - g)) : 0xFFFF);
+			used = below | above;
+			val = _mm512_maskz_loadu_epi32(below, rows[q] + g);
+			val = _mm512_mask_loadu_epi32(val, above, rows[q] + g - 1);
+			val = _mm512_mask_add_epi32(inf, used, val,
+					_mm512_mask_i32gather_epi32(inf, used,
+							_mm512_maskz_loadu_epi32(used, c + g), col, 4));
+			m = _mm512_reduce_min_epi32(val);
+			if (m < best) {
+				best = m;
+				best_i = g + __builtin_ctz(
+						_mm512_cmpeq_epi32_mask(val, _mm512_set1_epi32(m)));
+			}
+		}
+		out[q] = best;
+		par[q] = c[best_i] - 1;
+	}
+} /* Hk_set_avx512 */
+#endif
+
+/*------------------------------------------------------------------
+ * Function:            Perm_search
+ * Purpose:             Solve a tiny instance by enumerating the orders of
+ *                      cities 1..n-1 in place:  perm[d] is filled by
+ *                      swapping each of perm[d..n-1] into it in turn,
+ *                      and swapped back when its subtree is done.
+ *                      cost[d] is the cost of perm[0..d] and left[d] the
+ *                      min_out of the cities it has already left, so a
+ *                      prefix is pruned on the min-edge bound with one
+ *                      compare.  The nearest neighbour tour is the
+ *                      first incumbent.
+ * Global vars in:      mat, n, min_out, min_out_total
+ * Global vars in/out:  best_tour
+ */
+void Perm_search(void) {
+	city_t perm[PERM_MAX_N], best_perm[PERM_MAX_N];
+	weight_t cost[PERM_MAX_N], left[PERM_MAX_N];
+	int next[PERM_MAX_N];
+	weight_t best, total;
+	int d, i;
+	city_t tmp;
+
+	Nearest_neighbor_tour(best_perm);
+	best = Tour_cost(best_perm);
+	for (i = 0; i < n; i++)
+		perm[i] = i;
+	cost[0] = left[0] = 0;
+	d = 1;
+	next[1] = 1;
+	while (d > 0) {
+		i = next[d];
+		if (i == n) {
+			/* Subtree of perm[d - 1] done, restore its swap */
+			if (--d > 0) {
+				tmp = perm[d];
+				perm[d] = perm[next[d]];
+				perm[next[d]] = tmp;
+				next[d]++;
+			}
+			continue;
+		}
+		tmp = perm[d];
+		perm[d] = perm[i];
+		perm[i] = tmp;
+		cost[d] = cost[d - 1] + mat[n * perm[d - 1] + perm[d]];
+		left[d] = left[d - 1] + min_out[perm[d - 1]];
+		if (d == n - 1) {
+			total = cost[d] + mat[n * perm[d]];
+			if (total < best) {
+				best = total;
+				memcpy(best_perm, perm, n * sizeof(city_t));
+			}
+		} else if (cost[d] + min_out_total - left[d] < best) {
+			d++;
+			next[d] = d;
+			continue;
+		}
+		perm[i] = perm[d];
+		perm[d] = tmp;
+		next[d]++;
+	}
+	Update_best_tour(best_perm, best);
+} /* Perm_search */
+
+/*------------------------------------------------------------------
+ * Function:         Read_batch
+ * Purpose:          Read matrices in the format of Read_mat until the
+ *                   end of the file, and group consecutive instances of
+ *                   the same size BATCH_LANES at a time
+ * In arg:           mat_file
+ * Global vars out:  batch_count, batch_sizes, batch_mats, batch_tours,
+ *                   batch_group_count, batch_groups
+ */
+void Read_batch(FILE* mat_file) {
+	int size, i, j, capacity = 64;
+
+	batch_sizes = malloc(capacity * sizeof(int));
+	batch_mats = malloc(capacity * sizeof(weight_t*));
+	batch_groups = malloc((capacity + 1) * sizeof(int));
+	while (fscanf(mat_file, "%d", &size) == 1) {
+		if (size < 1 || size > BATCH_MAX_N) {
+			fprintf(stderr, "Instance %d has %d cities, batch mode "
+					"allows 1 to %d\n", batch_count, size, BATCH_MAX_N);
+			exit(1);
+		}
+		if (batch_count == capacity) {
+			capacity *= 2;
+			batch_sizes = realloc(batch_sizes, capacity * sizeof(int));
+			batch_mats = realloc(batch_mats, capacity * sizeof(weight_t*));
+			batch_groups = realloc(batch_groups, (capacity + 1) * sizeof(int));
+		}
+		batch_sizes[batch_count] = size;
+		batch_mats[batch_count] = malloc(size * size * sizeof(weight_t));
+		for (i = 0; i < size; i++)
+			for (j = 0; j < size; j++)
+				fscanf(mat_file, "%d", &batch_mats[batch_count][size * i + j]);
+
+		if (batch_count == 0 || size != batch_sizes[batch_count - 1]
+				|| batch_count - batch_groups[batch_group_count - 1]
+						== BATCH_LANES)
+			batch_groups[batch_group_count++] = batch_count;
+		batch_count++;
+	}
+	batch_groups[batch_group_count] = batch_count;
+
+	batch_tours = malloc(batch_count * sizeof(tour_t));
+	for (i = 0; i < batch_count; i++) {
+		batch_tours[i].cities = malloc((batch_sizes[i] + 1) * sizeof(city_t));
+		batch_tours[i].count = batch_sizes[i] + 1;
+	}
+} /* Read_batch */
+
+/*------------------------------------------------------------------
+ * Function:         Solve_batch
+ * Purpose:          Pick the lockstep kernel, solve the groups on
+ *                   thread_count threads, and print every instance's
+ *                   tour in the order they were read
+ * Global vars in:   thread_count, batch_count, batch_tours
+ * Global vars out:  batch_step
+ */
+void Solve_batch(void) {
+	pthread_t* thread_handles;
+	char title[64];
+	long i;
+
+	batch_step = Batch_step_scalar;
+#	if defined(__x86_64__) && !defined(HK_SCALAR)
+	if (__builtin_cpu_supports("avx512f"))
+		batch_step = Batch_step_avx512;
+	else if (__builtin_cpu_supports("avx2"))
+		batch_step = Batch_step_avx2;
+#	endif
+
+	thread_handles = malloc(thread_count * sizeof(pthread_t));
+	Start_threads(Batch_worker, thread_count, thread_handles);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(thread_handles[i], NULL);
+	free(thread_handles);
+
+	for (i = 0; i < batch_count; i++) {
+		sprintf(title, "Best tour of instance %ld", i);
+		Print_tour(&batch_tours[i], title);
+		printf("Cost = %d\n", batch_tours[i].cost);
+		free(batch_tours[i].cities);
+		free(batch_mats[i]);
+	}
+	free(batch_tours);
+	free(batch_mats);
+	free(batch_sizes);
+	free(batch_groups);
+} /* Solve_batch */
+
+/*------------------------------------------------------------------
+ * Function:        Batch_worker
+ * Purpose:         Claim groups of instances until there are none
+ *                  left, with dp tables sized for the largest group
+ * In arg:          rank
+ * Global vars in:  batch_count, batch_sizes, batch_group_count,
+ *                  batch_groups
+ * Global vars in/out:  batch_next_group
+ */
+void *Batch_worker(void* rank) {
+	int g, i, m = 0;
+	weight_t* dp, *costs;
+	unsigned char* par;
+
+	for (i = 0; i < batch_count; i++)
+		if (batch_sizes[i] - 1 > m)
+			m = batch_sizes[i] - 1;
+	dp = malloc(((size_t) m << m) * BATCH_LANES * sizeof(weight_t));
+	par = malloc(((size_t) m << m) * BATCH_LANES);
+	costs = malloc((m + 2) * m * BATCH_LANES * sizeof(weight_t));
+
+	while ((g = __atomic_fetch_add(&batch_next_group, 1, __ATOMIC_RELAXED))
+			< batch_group_count)
+		Batch_group(batch_groups[g], batch_groups[g + 1] - batch_groups[g],
+				dp, par, costs);
+
+	free(dp);
+	free(par);
+	free(costs);
+	return NULL;
+} /* Batch_worker */
+
+/*------------------------------------------------------------------
+ * Function:         Batch_group
+ * Purpose:          Solve count instances of the same size together.
+ *                   With m = n - 1, the cities other than 0 are the
+ *                   bits of a subset S of 0..m-1 (city j + 1 is bit j)
+ *                   and dp[S][j] is the cheapest path from 0 through S
+ *                   ending at j.  costs holds, for each lane, the cost
+ *                   into j from each k, then from 0 into j, then from j
+ *                   back to 0.
+ * In args:          first, count
+ * Scratch:          dp, par, costs
+ * Global vars in:   batch_sizes, batch_mats
+ * Global vars out:  batch_tours[first..first + count - 1]
+ */
+void Batch_group(int first, int count, weight_t* dp, unsigned char* par,
+		weight_t* costs) {
+	int size = batch_sizes[first], m = size - 1;
+	weight_t* from_0 = costs + m * m * BATCH_LANES;
+	weight_t* to_0 = from_0 + m * BATCH_LANES;
+	weight_t* mat_l, val;
+	unsigned long set, full = (1UL << m) - 1;
+	int l, j = 0, k, pos;
+	city_t* cities;
+
+	/* Structure of arrays, padding with copies of the last instance */
+	for (l = 0; l < BATCH_LANES; l++) {
+		mat_l = batch_mats[first + (l < count ? l : count - 1)];
+		for (j = 0; j < m; j++) {
+			for (k = 0; k < m; k++)
+				costs[(m * j + k) * BATCH_LANES + l] =
+						mat_l[size * (k + 1) + j + 1];
+			from_0[j * BATCH_LANES + l] = mat_l[j + 1];
+			to_0[j * BATCH_LANES + l] = mat_l[size * (j + 1)];
+		}
+	}
+
+	for (set = 1; set <= full; set++)
+		for (j = 0; j < m; j++) {
+			if (!(set & (1UL << j)))
+				continue;
+			if (set == 1UL << j)
+				memcpy(dp + (m * set + j) * BATCH_LANES,
+						from_0 + j * BATCH_LANES, BATCH_LANES * sizeof(weight_t));
+			else
+				batch_step(set & ~(1UL << j),
+						dp + m * (set & ~(1UL << j)) * BATCH_LANES,
+						costs + m * j * BATCH_LANES,
+						dp + (m * set + j) * BATCH_LANES,
+						par + (m * set + j) * BATCH_LANES);
+		}
+
+	for (l = 0; l < count; l++) {
+		cities = batch_tours[first + l].cities;
+		cities[0] = cities[size] = 0;
+		batch_tours[first + l].cost = m == 0 ? batch_mats[first + l][0] : INFINITY;
+		for (k = 0; k < m; k++) {
+			val = dp[(m * full + k) * BATCH_LANES + l] + to_0[k * BATCH_LANES + l];
+			if (val < batch_tours[first + l].cost) {
+				batch_tours[first + l].cost = val;
+				j = k;
+			}
+		}
+		for (set = full, pos = m; pos > 0; pos--) {
+			cities[pos] = j + 1;
+			k = par[(m * set + j) * BATCH_LANES + l];
+			set &= ~(1UL << j);
+			j = k;
+		}
+	}
+} /* Batch_group */
+
+/*------------------------------------------------------------------
+ * Function:   Batch_step_scalar
+ * Purpose:    One step of the lockstep recurrence:  for each lane, the
+ *             minimum over k in set of prev[k] + col[k], and the k
+ *             attaining it
+ * In args:    set:   S \ {j}
+ *             prev:  the dp row of S \ {j}, BATCH_LANES values per k
+ *             col:   the costs into j, BATCH_LANES values per k
+ * Out args:   out, par:  BATCH_LANES values each
+ */
+void Batch_step_scalar(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par) {
+	int k, l;
+	weight_t val;
+
+	for (l = 0; l < BATCH_LANES; l++)
+		out[l] = INFINITY;
+	for (; set != 0; set &= set - 1) {
+		k = __builtin_ctzl(set);
+		for (l = 0; l < BATCH_LANES; l++) {
+			val = prev[k * BATCH_LANES + l] + col[k * BATCH_LANES + l];
+			if (val < out[l]) {
+				out[l] = val;
+				par[l] = k;
+			}
+		}
+	}
+} /* Batch_step_scalar */
+
+#if defined(__x86_64__) && !defined(HK_SCALAR)
+/*------------------------------------------------------------------
+ * Function:   Batch_step_avx2
+ * Purpose:    Batch_step_scalar on two vectors of eight lanes
+ */
+__attribute__((target("avx2")))
+void Batch_step_avx2(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par) {
+	__m256i best[2], arg[2], val, less, kv;
+	int k, h, args[BATCH_LANES];
+
+	for (h = 0; h < 2; h++) {
+		best[h] = _mm256_set1_epi32(INFINITY);
+		arg[h] = _mm256_setzero_si256();
+	}
+	for (; set != 0; set &= set - 1) {
+		k = __builtin_ctzl(set);
+		kv = _mm256_set1_epi32(k);
+		for (h = 0; h < 2; h++) {
+			val = _mm256_add_epi32(
+					_mm256_loadu_si256((__m256i*) (prev + k * BATCH_LANES + 8 * h)),
+					_mm256_loadu_si256((__m256i*) (col + k * BATCH_LANES + 8 * h)));
+			less = _mm256_cmpgt_epi32(best[h], val);
+			best[h] = _mm256_min_epi32(best[h], val);
+			arg[h] = _mm256_blendv_epi8(arg[h], kv, less);
+		}
+	}
+	for (h = 0; h < 2; h++) {
+		_mm256_storeu_si256((__m256i*) (out + 8 * h), best[h]);
+		_mm256_storeu_si256((__m256i*) (args + 8 * h), arg[h]);
+	}
+	for (k = 0; k < BATCH_LANES; k++)
+		par[k] = args[k];
+} /* Batch_step_avx2 */
+
+/*------------------------------------------------------------------
+ * Function:   Batch_step_avx512
+ * Purpose:    Batch_step_scalar on one vector of sixteen lanes
+ */
+__attribute__((target("avx512f")))
+void Batch_step_avx512(unsigned long set, const weight_t* prev,
+		const weight_t* col, weight_t* out, unsigned char* par) {
+	__m512i best = _mm512_set1_epi32(INFINITY);
+	__m512i arg = _mm512_setzero_si512(), val;
+	int k;
+
+	for (; set != 0; set &= set - 1) {
+		k = __builtin_ctzl(set);
+		val = _mm512_add_epi32(_mm512_loadu_si512(prev + k * BATCH_LANES),
+				_mm512_loadu_si512(col + k * BATCH_LANES));
+		arg = _mm512_mask_mov_epi32(arg, _mm512_cmplt_epi32_mask(val, best),
+				_mm512_set1_epi32(k));
+		best = _mm512_min_epi32(best, val);
+	}
+	_mm512_storeu_si512(out, best);
+	_mm_storeu_si128((__m128i*) par, _mm512_cvtepi32_epi8(arg));
+} /* Batch_step_avx512 */
+#endif
+
+/*------------------------------------------------------------------
+ * Function:         Run_daemon
+ * Purpose:          Serve jobs on the Unix socket socket_name until
+ *                   SIGTERM or SIGINT, then finish the queued jobs and
+ *                   return.  The workers are started
+ *                   first; worker_count is at least 3 so that a
+ *                   portfolio solve gets one thread per engine.  This
+ *                   thread accepts clients, a Read_jobs thread per
+ *                   client queues its jobs, a Run_jobs thread runs
+ *                   them, a Watch_budgets thread enforces their CPU
+ *                   budgets, and with -M a Serve_metrics thread
+ *                   answers scrapes.
+ * In arg:           socket_name
+ * Global vars in:   thread_count, metrics_port
+ * Global vars out:  worker_count, worker_handles, worker_tasks,
+ *                   daemon_fd, metrics_fd, daemon_quit, bound_given,
+ *                   threads_given
+ */
+void Run_daemon(char* socket_name) {
+	struct sigaction quit_action;
+	struct sockaddr_un addr;
+	struct sockaddr_in metrics_addr;
+	struct timeval timeout = { REPLY_TIMEOUT_MS / 1000,
+			1000 * (REPLY_TIMEOUT_MS % 1000) };
+	pthread_t runner, watcher, reader, metrics;
+	conn_t* conn_p;
+	int fd, one = 1;
+	long i;
+
+	/* A job's bound can't be left unset, so auto picks it, and the
+	 * workers are a pool that auto may use fewer of (note 13) */
+	bound_given = threads_given = FALSE;
+	daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_name, sizeof(addr.sun_path) - 1);
+	unlink(socket_name);
+	if (daemon_fd < 0
+			|| bind(daemon_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+			|| listen(daemon_fd, 16) != 0) {
+		perror(socket_name);
+		exit(1);
+	}
+	if (metrics_port > 0) {
+		metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+		memset(&metrics_addr, 0, sizeof(metrics_addr));
+		metrics_addr.sin_family = AF_INET;
+		metrics_addr.sin_port = htons(metrics_port);
+		metrics_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (metrics_fd >= 0)
+			setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (metrics_fd < 0 || bind(metrics_fd, (struct sockaddr*)
+				&metrics_addr, sizeof(metrics_addr)) != 0
+				|| listen(metrics_fd, 16) != 0) {
+			perror("metrics port");
+			exit(1);
+		}
+	}
+
+	pthread_rwlock_init(&best_tour_lock, NULL);
+	pthread_cond_init(&term_cond_var, NULL);
+	pthread_cond_init(&bench_cond, NULL);
+	pthread_mutex_init(&term_mutex, NULL);
+	Init_monitor();
+	pthread_mutex_init(&worker_mutex, NULL);
+	pthread_cond_init(&worker_cond, NULL);
+	pthread_cond_init(&worker_idle_cond, NULL);
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	pthread_cond_init(&space_cond, NULL);
+	pthread_mutex_init(&metrics_mutex, NULL);
+
+	worker_count = thread_count < 3 ? 3 : thread_count;
+	worker_tasks = calloc(worker_count, sizeof(worker_task_t));
+	worker_handles = malloc(worker_count * sizeof(pthread_t));
+	for (i = 0; i < worker_count; i++)
+		pthread_create(&worker_handles[i], NULL, Worker, (void*) i);
+	pthread_create(&runner, NULL, Run_jobs, NULL);
+	pthread_create(&watcher, NULL, Watch_budgets, NULL);
+	if (metrics_fd >= 0)
+		pthread_create(&metrics, NULL, Serve_metrics, NULL);
+
+	/* Quit_handler shuts daemon_fd down to end this loop.  No
+	 * SA_RESTART, so accept also returns if the signal lands here. */
+	memset(&quit_action, 0, sizeof(quit_action));
+	quit_action.sa_handler = Quit_handler;
+	sigaction(SIGTERM, &quit_action, NULL);
+	sigaction(SIGINT, &quit_action, NULL);
+	while ((fd = accept(daemon_fd, NULL, NULL)) >= 0) {
+		/* Replies are sent by Run_jobs, which mustn't block on a client
+		 * that has stopped reading them */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		conn_p = malloc(sizeof(conn_t));
+		conn_p->fd = fd;
+		conn_p->pending = 0;
+		conn_p->pending_bytes = 0;
+		conn_p->reading = TRUE;
+		pthread_mutex_init(&conn_p->lock, NULL);
+		pthread_create(&reader, NULL, Read_jobs, conn_p);
+		pthread_detach(reader);
+	}
+	pthread_mutex_lock(&job_mutex);
+	daemon_quit = TRUE;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	pthread_join(runner, NULL);
+	pthread_join(watcher, NULL);
+	if (metrics_fd >= 0) {
+		shutdown(metrics_fd, SHUT_RDWR);
+		pthread_join(metrics, NULL);
+		close(metrics_fd);
+	}
+	pthread_mutex_lock(&worker_mutex);
+	worker_quit = TRUE;
+	pthread_cond_broadcast(&worker_cond);
+	pthread_mutex_unlock(&worker_mutex);
+	for (i = 0; i < worker_count; i++)
+		pthread_join(worker_handles[i], NULL);
+	free(worker_handles);
+	free(worker_tasks);
+	close(daemon_fd);
+	unlink(socket_name);
+} /* Run_daemon */
+
+/*------------------------------------------------------------------
+ * Function:         Quit_handler
+ * Purpose:          Stop the daemon taking clients, which ends
+ *                   Run_daemon's accept loop.  shutdown is
+ *                   async-signal-safe.
+ * In arg:           sig
+ * Global var in:    daemon_fd
+ */
+void Quit_handler(int sig) {
+	shutdown(daemon_fd, SHUT_RDWR);
+} /* Quit_handler */
+
+/*------------------------------------------------------------------
+ * Function:            Read_jobs
+ * Purpose:             Queue each job a client sends until it closes
+ *                      its end or sends something invalid, parking the
+ *                      running job if the new one is more urgent
+ * In arg:              arg:  the client's conn_t
+ * Global vars in:      running_job
+ * Global vars in/out:  job_head, job_tail
+ */
+void *Read_jobs(void* arg) {
+	struct timeval timeout = { COSTS_TIMEOUT_MS / 1000,
+			1000 * (COSTS_TIMEOUT_MS % 1000) }, no_timeout = { 0, 0 };
+	conn_t* conn_p = arg;
+	job_t* job_p;
+	int header[6];
+	long bytes;
+
+	while (Read_all(conn_p->fd, header, sizeof(header))) {
+		if (header[0] < 1 || header[0] > DAEMON_MAX_N
+				|| header[1] < ENGINE_AUTO || header[1] > ENGINE_PERM
+				|| header[2] < BOUND_NONE || header[2] > BOUND_MIN_EDGE
+				|| header[3] < 0 || header[3] >= JOB_PRIORITIES
+				|| header[4] < 0)
+			break;
+		bytes = (long) header[0] * header[0] * sizeof(weight_t);
+		if (!Reserve_costs(conn_p, bytes))
+			break;
+		job_p = malloc(sizeof(job_t));
+		if (job_p == NULL || (job_p->mat = malloc(bytes)) == NULL) {
+			free(job_p);
+			Free_costs(conn_p, bytes);
+			break;
+		}
+		job_p->conn_p = conn_p;
+		job_p->n = header[0];
+		job_p->engine = header[1];
+		job_p->bound = header[2];
+		job_p->priority = header[3];
+		job_p->budget = header[4] / 1000.0;
+		job_p->id = header[5];
+		job_p->cpu_used = 0.0;
+		job_p->arrived = Now();
+		job_p->saved = NULL;
+		/* A client may wait as long as it likes between jobs, but not
+		 * hold a reservation while sending nothing */
+		setsockopt(conn_p->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+				sizeof(timeout));
+		if (!Read_all(conn_p->fd, job_p->mat, bytes)) {
+			free(job_p->mat);
+			free(job_p);
+			Free_costs(conn_p, bytes);
+			break;
+		}
+		setsockopt(conn_p->fd, SOL_SOCKET, SO_RCVTIMEO, &no_timeout,
+				sizeof(no_timeout));
+
+		pthread_mutex_lock(&conn_p->lock);
+		conn_p->pending++;
+		pthread_mutex_unlock(&conn_p->lock);
+		pthread_mutex_lock(&job_mutex);
+		Queue_job(job_p, FALSE);
+		if (running_job != NULL && job_p->priority < running_job->priority
+				&& !solve_parking)
+			Park_search();
+		pthread_cond_signal(&job_cond);
+		pthread_mutex_unlock(&job_mutex);
+	}
+
+	pthread_mutex_lock(&conn_p->lock);
+	conn_p->reading = FALSE;
+	conn_p->pending++; /* Balanced by the Release_conn below */
+	pthread_mutex_unlock(&conn_p->lock);
+	Release_conn(conn_p);
+	return NULL;
+} /* Read_jobs */
+
+/*------------------------------------------------------------------
+ * Function:            Queue_job
+ * Purpose:             Add a job to the queue of its priority:  at the
+ *                      tail, or at the head for a parked job, so that
+ *                      it resumes before later jobs of its priority.
+ *                      job_mutex must be held.
+ * In args:             job_p, at_head
+ * Global vars in/out:  job_head, job_tail
+ */
+void Queue_job(job_t* job_p, int at_head) {
+	int p = job_p->priority;
+
+	if (job_head[p] == NULL) {
+		job_p->next_p = NULL;
+		job_head[p] = job_tail[p] = job_p;
+	} else if (at_head) {
+		job_p->next_p = job_head[p];
+		job_head[p] = job_p;
+	} else {
+		job_p->next_p = NULL;
+		job_tail[p]->next_p = job_p;
+		job_tail[p] = job_p;
+	}
+} /* Queue_job */
+
+/*------------------------------------------------------------------
+ * Function:            Run_jobs
+ * Purpose:             Take the most urgent job off the queues, solve
+ *                      it on the workers and send back its tour, until
+ *                      the daemon is asked to quit and the queues are
+ *                      empty.  A job parked by Read_jobs is saved and
+ *                      queued again instead of being answered.
+ * Global vars in:      worker_count
+ * Global vars in/out:  job_head, job_tail, running_job, running_since,
+ *                      budget_stop, solve_parking, and the instance
+ *                      globals (n, mat, engine, bound, best_tour, ...)
+ */
+void *Run_jobs(void* arg) {
+	job_t* job_p;
+	int header[5], p, parked;
+	double cpu;
+
+	while (TRUE) {
+		pthread_mutex_lock(&job_mutex);
+		while (TRUE) {
+			for (p = 0; p < JOB_PRIORITIES && job_head[p] == NULL; p++)
+				;
+			if (p < JOB_PRIORITIES || daemon_quit)
+				break;
+			pthread_cond_wait(&job_cond, &job_mutex);
+		}
+		if (p == JOB_PRIORITIES) {
+			pthread_mutex_unlock(&job_mutex);
+			break;
+		}
+		job_p = job_head[p];
+		job_head[p] = job_p->next_p;
+		if (job_head[p] == NULL)
+			job_tail[p] = NULL;
+		running_job = job_p;
+		running_since = Cpu_time();
+		budget_stop = FALSE;
+		pthread_mutex_unlock(&job_mutex);
+
+		thread_count = worker_count;
+		if (job_p->saved != NULL) {
+			Restore_instance(job_p);
+		} else {
+			n = mat_capacity = job_p->n;
+			mat = job_p->mat;
+			engine = job_p->engine;
+			bound = job_p->bound;
+			Start_instance();
+		}
+		Solve();
+
+		pthread_mutex_lock(&job_mutex);
+		running_job = NULL;
+		cpu = Cpu_time() - running_since;
+		job_p->cpu_used += cpu;
+		parked = solve_parking && !solve_complete && !budget_stop;
+		solve_parking = FALSE;
+		solve_done = FALSE; /* A late Park_search may have set it */
+		if (parked) {
+			Save_instance(job_p);
+			Queue_job(job_p, TRUE);
+		}
+		pthread_mutex_unlock(&job_mutex);
+		if (metrics_fd >= 0)
+			Count_run(cpu, parked);
+		if (parked)
+			continue;
+
+		header[0] = best_tour.cost;
+		header[1] = best_tour.count;
+		header[2] = solve_complete ? JOB_COMPLETE
+				: budget_stop ? JOB_OVER_BUDGET : JOB_STOPPED;
+		header[3] = solve_lower_bound;
+		header[4] = job_p->id;
+		/* A client that has gone, or hasn't taken the reply within
+		 * REPLY_TIMEOUT_MS, is dropped:  shutting the socket down makes
+		 * its later replies fail at once and ends its Read_jobs */
+		if (!Write_all(job_p->conn_p->fd, header, sizeof(header))
+				|| !Write_all(job_p->conn_p->fd, best_tour.cities,
+						best_tour.count * sizeof(city_t)))
+			shutdown(job_p->conn_p->fd, SHUT_RDWR);
+		if (metrics_fd >= 0)
+			Count_reply(job_p, header[2]);
+		Free_instance();
+		Free_costs(job_p->conn_p,
+				(long) job_p->n * job_p->n * sizeof(weight_t));
+		Release_conn(job_p->conn_p);
+		free(job_p);
+	}
+	return NULL;
+} /* Run_jobs */
+
+/*------------------------------------------------------------------
+ * Function:         Save_instance
+ * Purpose:          Move the instance globals, the parked DFS frontier
+ *                   and the prefix pool into job_p->saved
+ * In/out arg:       job_p
+ * Global vars out:  parked_stack, parked_size, pool_prefixes,
+ *                   nbr_lists, nbr_count
+ */
+void Save_instance(job_t* job_p) {
+	instance_t* inst_p = malloc(sizeof(instance_t));
+
+	inst_p->n = n;
+	inst_p->mat_capacity = mat_capacity;
+	inst_p->mat = mat;
+	inst_p->min_out = min_out;
+	inst_p->min_out_total = min_out_total;
+	inst_p->nbr_lists = nbr_lists;
+	inst_p->nbr_count = nbr_count;
+	inst_p->best_tour = best_tour;
+	inst_p->engine = engine;
+	inst_p->bound = bound;
+	inst_p->parked_stack = parked_stack;
+	inst_p->parked_size = parked_size;
+	inst_p->pool_prefixes = pool_prefixes;
+	inst_p->pool_depth = pool_depth;
+	inst_p->pool_count = pool_count;
+	inst_p->pool_next = pool_next;
+	job_p->saved = inst_p;
+
+	parked_stack = NULL;
+	parked_size = 0;
+	pool_prefixes = NULL;
+	nbr_lists = NULL;
+	nbr_count = 0;
+} /* Save_instance */
+
+/*------------------------------------------------------------------
+ * Function:         Restore_instance
+ * Purpose:          Undo Save_instance and free job_p->saved
+ * In/out arg:       job_p
+ * Global vars out:  the instance globals, parked_stack, parked_size
+ *                   and the prefix pool
+ */
+void Restore_instance(job_t* job_p) {
+	instance_t* inst_p = job_p->saved;
+
+	n = inst_p->n;
+	mat_capacity = inst_p->mat_capacity;
+	mat = inst_p->mat;
+	min_out = inst_p->min_out;
+	min_out_total = inst_p->min_out_total;
+	nbr_lists = inst_p->nbr_lists;
+	nbr_count = inst_p->nbr_count;
+	best_tour = inst_p->best_tour;
+	engine = inst_p->engine;
+	bound = inst_p->bound;
+	parked_stack = inst_p->parked_stack;
+	parked_size = inst_p->parked_size;
+	pool_prefixes = inst_p->pool_prefixes;
+	pool_depth = inst_p->pool_depth;
+	pool_count = inst_p->pool_count;
+	pool_next = inst_p->pool_next;
+	free(inst_p);
+	job_p->saved = NULL;
+} /* Restore_instance */
+
+/*------------------------------------------------------------------
+ * Function:         Watch_budgets
+ * Purpose:          Every BUDGET_POLL_MS, stop the running job if its
+ *                   CPU time over all its runs is past its budget.
+ *                   Returns once Run_jobs has nothing left to run.
+ * Global vars in:   running_job, running_since, job_head, daemon_quit
+ * Global vars out:  budget_stop
+ */
+void *Watch_budgets(void* arg) {
+	struct timespec poll = { 0, BUDGET_POLL_MS * 1000000L };
+	job_t* job_p;
+	int p;
+
+	while (TRUE) {
+		nanosleep(&poll, NULL);
+		pthread_mutex_lock(&job_mutex);
+		job_p = running_job;
+		for (p = 0; p < JOB_PRIORITIES && job_head[p] == NULL; p++)
+			;
+		if (daemon_quit && job_p == NULL && p == JOB_PRIORITIES) {
+			pthread_mutex_unlock(&job_mutex);
+			break;
+		}
+		if (job_p != NULL && job_p->budget > 0.0 && !budget_stop
+				&& job_p->cpu_used + Cpu_time() - running_since
+						> job_p->budget) {
+			budget_stop = TRUE;
+			Finish_search();
+		}
+		pthread_mutex_unlock(&job_mutex);
+	}
+	return NULL;
+} /* Watch_budgets */
+
+/*------------------------------------------------------------------
+ * Function:   Cpu_time
+ * Purpose:    CPU seconds used by the whole process.  Jobs run one
+ *             at a time, so the difference over a run is the job's.
+ */
+double Cpu_time(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec + 1e-9 * now.tv_nsec;
+} /* Cpu_time */
+
+/*------------------------------------------------------------------
+ * Function:   Now
+ * Purpose:    Seconds on the monotonic clock
+ */
+double Now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1e-9 * now.tv_nsec;
+} /* Now */
+
+/*------------------------------------------------------------------
+ * Function:         Count_run
+ * Purpose:          Add a run of the daemon's job to the metrics:  its
+ *                   CPU seconds and the DFS's nodes, by engine
+ * In args:          cpu, parked:  TRUE if it was preempted
+ * Global vars in:   engine, solve_nodes, solve_prunes
+ * Global vars out:  metric_cpu, metric_nodes, metric_prunes,
+ *                   metric_parked
+ */
+void Count_run(double cpu, int parked) {
+	pthread_mutex_lock(&metrics_mutex);
+	metric_cpu[engine] += cpu;
+	metric_nodes[engine] += solve_nodes;
+	metric_prunes[engine] += solve_prunes;
+	if (parked)
+		metric_parked++;
+	pthread_mutex_unlock(&metrics_mutex);
+} /* Count_run */
+
+/*------------------------------------------------------------------
+ * Function:         Count_reply
+ * Purpose:          Add an answered job to the metrics:  its engine,
+ *                   status, and latency from arrival to reply
+ * In args:          job_p, status
+ * Global vars in:   engine
+ * Global vars out:  metric_jobs, metric_latency, metric_latency_sum
+ */
+void Count_reply(job_t* job_p, job_status_t status) {
+	double latency = Now() - job_p->arrived;
+	int c, b;
+
+	for (c = 0; c < METRIC_N_CLASSES - 1 && job_p->n > METRIC_N_BOUNDS[c];
+			c++)
+		;
+	for (b = 0; b < METRIC_BUCKETS - 1 && latency > METRIC_LATENCY_BOUNDS[b];
+			b++)
+		;
+	pthread_mutex_lock(&metrics_mutex);
+	metric_jobs[engine][status]++;
+	metric_latency[c][b]++;
+	metric_latency_sum[c] += latency;
+	pthread_mutex_unlock(&metrics_mutex);
+} /* Count_reply */
+
+/*------------------------------------------------------------------
+ * Function:         Serve_metrics
+ * Purpose:          Answer HTTP requests on metrics_fd until it is shut
+ *                   down:  GET /metrics gets the metrics, anything else
+ *                   a 404.  One request per connection.  The reply
+ *                   is built in memory and sent with Write_all, so a
+ *                   client that resets the connection can't kill the
+ *                   daemon with SIGPIPE.  A client gets
+ *                   METRICS_TIMEOUT_MS for each read and write, so one
+ *                   that stalls can't hold up later scrapes or the
+ *                   daemon's shutdown.
+ * Global vars in:   metrics_fd
+ */
+void *Serve_metrics(void* arg) {
+	struct timeval timeout = { METRICS_TIMEOUT_MS / 1000,
+			1000 * (METRICS_TIMEOUT_MS % 1000) };
+	char request[1024];
+	char* reply;
+	size_t reply_bytes, total;
+	ssize_t got;
+	FILE* out;
+	int fd;
+
+	while ((fd = accept(metrics_fd, NULL, NULL)) >= 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		/* Only the request line matters; read until the headers end */
+		total = 0;
+		while (total < sizeof(request) - 1
+				&& (got = read(fd, request + total,
+						sizeof(request) - 1 - total)) > 0) {
+			total += got;
+			request[total] = '\0';
+			if (strstr(request, "\r\n\r\n") != NULL)
+				break;
+		}
+		request[total] = '\0';
+		out = open_memstream(&reply, &reply_bytes);
+		if (out == NULL) {
+			close(fd);
+			continue;
+		}
+		if (strncmp(request, "GET /metrics ", 13) == 0) {
+			fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+					"version=0.0.4\r\nConnection: close\r\n\r\n");
+			Write_metrics(out);
+		} else {
+			fprintf(out, "HTTP/1.0 404 Not Found\r\nContent-Type: "
+					"text/plain\r\nConnection: close\r\n\r\n"
+					"Try /metrics\n");
+		}
+		fclose(out);
+		Write_all(fd, reply, reply_bytes);
+		free(reply);
+		close(fd);
+	}
+	return NULL;
+} /* Serve_metrics */
+
+/*------------------------------------------------------------------
+ * Function:         Write_metrics
+ * Purpose:          Write the daemon's metrics to out in Prometheus'
+ *                   text format (note 32)
+ * In arg:           out
+ * Global vars in:   the metric_* counters, job_head, running_job
+ */
+void Write_metrics(FILE* out) {
+	int queued[JOB_PRIORITIES], running, p, e, s, c, b;
+	long cumulative;
+	job_t* job_p;
+
+	pthread_mutex_lock(&job_mutex);
+	for (p = 0; p < JOB_PRIORITIES; p++) {
+		queued[p] = 0;
+		for (job_p = job_head[p]; job_p != NULL; job_p = job_p->next_p)
+			queued[p]++;
+	}
+	running = running_job != NULL;
+	pthread_mutex_unlock(&job_mutex);
+
+	fprintf(out, "# HELP tsp_queue_depth Jobs waiting to run.\n"
+			"# TYPE tsp_queue_depth gauge\n");
+	for (p = 0; p < JOB_PRIORITIES; p++)
+		fprintf(out, "tsp_queue_depth{priority=\"%d\"} %d\n", p, queued[p]);
+	fprintf(out, "# HELP tsp_jobs_running Jobs being solved.\n"
+			"# TYPE tsp_jobs_running gauge\ntsp_jobs_running %d\n", running);
+
+	pthread_mutex_lock(&metrics_mutex);
+	fprintf(out, "# HELP tsp_jobs_total Jobs answered.\n"
+			"# TYPE tsp_jobs_total counter\n");
+	for (e = 0; e < ENGINE_COUNT; e++)
+		for (s = 0; s < JOB_STATUSES; s++)
+			if (metric_jobs[e][s] > 0)
+				fprintf(out, "tsp_jobs_total{engine=\"%s\",status=\"%s\"} "
+						"%ld\n", engine_names[e], status_names[s],
+						metric_jobs[e][s]);
+	fprintf(out, "# HELP tsp_jobs_parked_total Runs preempted by a more "
+			"urgent job.\n# TYPE tsp_jobs_parked_total counter\n"
+			"tsp_jobs_parked_total %ld\n", metric_parked);
+
+	fprintf(out, "# HELP tsp_job_latency_seconds Time from a job's arrival "
+			"to its reply, by the largest n of its class.\n"
+			"# TYPE tsp_job_latency_seconds histogram\n");
+	for (c = 0; c < METRIC_N_CLASSES; c++) {
+		cumulative = 0;
+		for (b = 0; b < METRIC_BUCKETS; b++) {
+			cumulative += metric_latency[c][b];
+			fprintf(out, "tsp_job_latency_seconds_bucket{n_le=\"");
+			if (c < METRIC_N_CLASSES - 1)
+				fprintf(out, "%d", METRIC_N_BOUNDS[c]);
+			else
+				fprintf(out, "+Inf");
+			if (b < METRIC_BUCKETS - 1)
+				fprintf(out, "\",le=\"%g\"} %ld\n",
+						METRIC_LATENCY_BOUNDS[b], cumulative);
+			else
+				fprintf(out, "\",le=\"+Inf\"} %ld\n", cumulative);
+		}
+		if (c < METRIC_N_CLASSES - 1)
+			fprintf(out, "tsp_job_latency_seconds_sum{n_le=\"%d\"} %.6f\n"
+					"tsp_job_latency_seconds_count{n_le=\"%d\"} %ld\n",
+					METRIC_N_BOUNDS[c], metric_latency_sum[c],
+					METRIC_N_BOUNDS[c], cumulative);
+		else
+			fprintf(out, "tsp_job_latency_seconds_sum{n_le=\"+Inf\"} %.6f\n"
+					"tsp_job_latency_seconds_count{n_le=\"+Inf\"} %ld\n",
+					metric_latency_sum[c], cumulative);
+	}
+
+	fprintf(out, "# HELP tsp_dfs_nodes_total DFS nodes expanded.\n"
+			"# TYPE tsp_dfs_nodes_total counter\n");
+	for (e = 0; e < ENGINE_COUNT; e++)
+		fprintf(out, "tsp_dfs_nodes_total{engine=\"%s\"} %ld\n",
+				engine_names[e], metric_nodes[e]);
+	fprintf(out, "# HELP tsp_dfs_prunes_total DFS children pruned.\n"
+			"# TYPE tsp_dfs_prunes_total counter\n");
+	for (e = 0; e < ENGINE_COUNT; e++)
+		fprintf(out, "tsp_dfs_prunes_total{engine=\"%s\"} %ld\n",
+				engine_names[e], metric_prunes[e]);
+	fprintf(out, "# HELP tsp_cpu_seconds_total CPU time spent solving.\n"
+			"# TYPE tsp_cpu_seconds_total counter\n");
+	for (e = 0; e < ENGINE_COUNT; e++)
+		fprintf(out, "tsp_cpu_seconds_total{engine=\"%s\"} %.6f\n",
+				engine_names[e], metric_cpu[e]);
+	pthread_mutex_unlock(&metrics_mutex);
+} /* Write_metrics */
+
+/*------------------------------------------------------------------
+ * Function:   Release_conn
+ * Purpose:    Note that a job of conn_p has been answered, and close
+ *             and free conn_p if it was the last thing using it
+ * In arg:     conn_p
+ */
+void Release_conn(conn_t* conn_p) {
+	int last;
+
+	pthread_mutex_lock(&conn_p->lock);
+	last = --conn_p->pending == 0 && !conn_p->reading;
+	pthread_mutex_unlock(&conn_p->lock);
+	if (last) {
+		close(conn_p->fd);
+		pthread_mutex_destroy(&conn_p->lock);
+		free(conn_p);
+	}
+} /* Release_conn */
+
+/*------------------------------------------------------------------
+ * Function:            Reserve_costs
+ * Purpose:             Reserve bytes for the costs of a job from
+ *                      conn_p, waiting until the unanswered jobs of all
+ *                      clients leave room for them under
+ *                      DAEMON_MAX_QUEUED_BYTES
+ * In args:             conn_p, bytes
+ * Global vars in/out:  queued_bytes
+ * Ret val:             FALSE, reserving nothing, if conn_p's own
+ *                      unanswered jobs would pass
+ *                      DAEMON_MAX_PENDING_BYTES
+ */
+int Reserve_costs(conn_t* conn_p, long bytes) {
+	pthread_mutex_lock(&conn_p->lock);
+	if (conn_p->pending_bytes + bytes > DAEMON_MAX_PENDING_BYTES) {
+		pthread_mutex_unlock(&conn_p->lock);
+		return FALSE;
+	}
+	conn_p->pending_bytes += bytes;
+	pthread_mutex_unlock(&conn_p->lock);
+
+	pthread_mutex_lock(&job_mutex);
+	while (queued_bytes + bytes > DAEMON_MAX_QUEUED_BYTES)
+		pthread_cond_wait(&space_cond, &job_mutex);
+	queued_bytes += bytes;
+	pthread_mutex_unlock(&job_mutex);
+	return TRUE;
+} /* Reserve_costs */
+
+/*------------------------------------------------------------------
+ * Function:            Free_costs
+ * Purpose:             Give back what Reserve_costs reserved
+ * In args:             conn_p, bytes
+ * Global vars in/out:  queued_bytes
+ */
+void Free_costs(conn_t* conn_p, long bytes) {
+	pthread_mutex_lock(&conn_p->lock);
+	conn_p->pending_bytes -= bytes;
+	pthread_mutex_unlock(&conn_p->lock);
+	pthread_mutex_lock(&job_mutex);
+	queued_bytes -= bytes;
+	pthread_cond_broadcast(&space_cond);
+	pthread_mutex_unlock(&job_mutex);
+} /* Free_costs */
+
+/*------------------------------------------------------------------
+ * Function:   Read_all
+ * Purpose:    Read exactly bytes bytes from fd
+ * Ret val:    FALSE at the end of the stream or on an error
+ */
+int Read_all(int fd, void* buf, size_t bytes) {
+	ssize_t got;
+
+	while (bytes > 0) {
+		got = read(fd, buf, bytes);
+		if (got <= 0)
+			return FALSE;
+		buf = (char*) buf + got;
+		bytes -= got;
+	}
+	return TRUE;
+} /* Read_all */
+
+/*------------------------------------------------------------------
+ * Function:   Write_all
+ * Purpose:    Write all of buf to fd, without dying of SIGPIPE if the
+ *             client has gone
+ * Ret val:    FALSE on an error
+ */
+int Write_all(int fd, const void* buf, size_t bytes) {
+	ssize_t put;
+
+	while (bytes > 0) {
+		put = send(fd, buf, bytes, MSG_NOSIGNAL);
+		if (put <= 0)
+			return FALSE;
+		buf = (const char*) buf + put;
+		bytes -= put;
+	}
+	return TRUE;
+} /* Write_all */
@@ -0,0 +1,56 @@
+#!/bin/sh
+# File:     tsp_bench.sh
+# Purpose:  Time the engines of pth_tsp_search_nr on random instances
+#           from gen_mat.  The constants of the auto engine's cost model
+#           (AUTO_* in pth_tsp_search_nr_part2.c) were fitted to the
+#           output of this script.
+# Usage:    ./tsp_bench.sh [<numbers of threads> [<engines> [<sizes>
+#              [<flags>]]]]
+#           e.g. ./tsp_bench.sh 4 "dfs hk" "12 14 16"
+#           or, to see oversubscription, ./tsp_bench.sh "1 4 16" dfs 16
+#           and the same with the flags -C
+#           or, to compare idle spinning with sleeping at once (note 24
+#           of pth_tsp_search_nr_part2.c), ./tsp_bench.sh "2 4 8" dfs 16
+#           "-p 1000 -i 20000" and the same with "-p 1000 -i 0"
+# Output:   One line per run:  engine bound n threads seconds cost
+#           With -p in <flags>, each run is followed by its handoff
+#           latencies, as a line starting with "#"
+#
+# Notes:
+# 1.  gen_mat always produces the same matrix for a given n.
+# 2.  The programs are built in a scratch directory that is removed
+#     on exit.
+# 3.  <flags> are passed to every run of pth_tsp_search_nr.
+
+THREADS=${1:-4}
+ENGINES=${2:-"dfs:none dfs:minedge hk anneal aco"}
+SIZES=${3:-"10 12 14 16 18"}
+FLAGS=${4:-}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+cp gen_mat.source "$DIR/gen_mat.c"
+gcc -O2 -o "$DIR/gen_mat" "$DIR/gen_mat.c" || exit 1
+gcc -O2 -o "$DIR/pth_tsp_search_nr" pth_tsp_search_nr_part2.c \
+	-lpthread -lm || exit 1
+
+echo "engine bound n threads seconds cost"
+for N in $SIZES; do
+	"$DIR/gen_mat" "$N" > "$DIR/mat_$N"
+	for SPEC in $ENGINES; do
+		ENGINE=${SPEC%%:*}
+		BOUND=${SPEC#*:}
+		[ "$BOUND" = "$SPEC" ] && BOUND=none
+		for T in $THREADS; do
+			START=$(date +%s%N)
+			COST=$("$DIR/pth_tsp_search_nr" $FLAGS -e "$ENGINE" -b "$BOUND" \
+				"$T" "$DIR/mat_$N" 2> "$DIR/err" | sed -n 's/^Cost = //p')
+			END=$(date +%s%N)
+			echo "$ENGINE $BOUND $N $T" \
+				"$(awk "BEGIN { printf \"%.4f\", ($END - $START) / 1e9 }")" \
+				"$COST"
+			sed -n 's/^handoffs: /# handoffs: /p' "$DIR/err"
+		done
+	done
+done
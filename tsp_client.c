@@ -0,0 +1,239 @@
+/* File:     tsp_client.c
+ * Purpose:  Send matrices to pth_tsp_search_nr running as a daemon (-d)
+ *           and print the tours it sends back.
+ *
+ * Input:    Matrix files in the format read by pth_tsp_search_nr
+ * Output:   For each job, the best tour and its cost.  On stderr, the
+ *           number of jobs and the mean time from sending a job to
+ *           getting its tour back.
+ *
+ * Compile:  gcc -g -Wall -o tsp_client tsp_client.c
+ * Run:      ./tsp_client [-e <engine>] [-b <bound>] [-p <priority>]
+ *              [-c <CPU budget in ms>] [-r <repeats>]
+ *              <socket> [<matrix file> ...]
+ *
+ * Notes:
+ * 1.  The wire format is described in note 20 of pth_tsp_search_nr_part2.c:
+ *     a job is the ints n, engine, bound, priority, budget, id and the
+ *     n * n costs, and the reply the ints cost, count, status, lower
+ *     bound, id and the count cities of the tour.
+ * 2.  Jobs are numbered from 0 in the order they are sent, and that
+ *     number is their id.  Replies come in the order the jobs finish,
+ *     which preemption can change, so each is matched to its job by id.
+ * 3.  engine_names and bound_names must be in the order of the
+ *     daemon's engine_t and bound_t.
+ * 4.  Each file is sent repeats times.  All jobs are sent before any
+ *     reply is read, so the daemon's queue is exercised.
+ * 5.  Priority 0 is the most urgent.  A budget of 0, the default, means
+ *     none.  For a job stopped early, or one a heuristic answered, the
+ *     lower bound is printed too.
+ * 6.  A client can't stop the daemon:  send it SIGTERM, and it exits
+ *     once its queues are empty.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+const char* engine_names[] = { "auto", "dfs", "anneal", "aco", "hk",
+      "portfolio", "perm" };
+const char* bound_names[] = { "none", "minedge" };
+const char* status_names[] = { "", "CPU budget", "node budget" };
+
+void Usage(char* prog_name);
+int Lookup(const char* names[], int count, char* name);
+int* Read_job(char* file_name, int engine, int bound, int priority,
+      int budget);
+int Read_all(int fd, void* buf, size_t bytes);
+int Write_all(int fd, const void* buf, size_t bytes);
+double Now(void);
+
+int main(int argc, char* argv[]) {
+   int engine = 0, bound = 0, priority = 0, budget = 0, repeats = 1;
+   int opt, fd, i, r, jobs = 0, reply[5];
+   int** job_list;
+   int* cities;
+   double* sent;
+   double total = 0.0;
+   struct sockaddr_un addr;
+
+   while ((opt = getopt(argc, argv, "e:b:p:c:r:")) != -1) {
+      if (opt == 'e')
+         engine = Lookup(engine_names, 7, optarg);
+      else if (opt == 'b')
+         bound = Lookup(bound_names, 2, optarg);
+      else if (opt == 'p')
+         priority = strtol(optarg, NULL, 10);
+      else if (opt == 'c')
+         budget = strtol(optarg, NULL, 10);
+      else if (opt == 'r')
+         repeats = strtol(optarg, NULL, 10);
+      else
+         Usage(argv[0]);
+   }
+   if (optind >= argc || engine < 0 || bound < 0 || priority < 0
+         || budget < 0 || repeats < 1)
+      Usage(argv[0]);
+
+   fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, argv[optind], sizeof(addr.sun_path) - 1);
+   if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+      perror(argv[optind]);
+      exit(1);
+   }
+
+   job_list = malloc((argc - optind) * sizeof(int*));
+   for (i = optind + 1; i < argc; i++)
+      job_list[i - optind - 1] = Read_job(argv[i], engine, bound,
+            priority, budget);
+   sent = malloc((argc - optind - 1) * repeats * sizeof(double));
+
+   for (r = 0; r < repeats; r++)
+      for (i = 0; i < argc - optind - 1; i++) {
+         job_list[i][5] = jobs;
+         sent[jobs++] = Now();
+         Write_all(fd, job_list[i],
+               (6 + job_list[i][0] * job_list[i][0]) * sizeof(int));
+      }
+
+   for (i = 0; i < jobs; i++) {
+      if (!Read_all(fd, reply, sizeof(reply))) {
+         fprintf(stderr, "Daemon closed the connection after %d replies\n",
+               i);
+         exit(1);
+      }
+      if (reply[4] < 0 || reply[4] >= jobs) {
+         fprintf(stderr, "Reply for unknown job %d\n", reply[4]);
+         exit(1);
+      }
+      cities = malloc(reply[1] * sizeof(int));
+      Read_all(fd, cities, reply[1] * sizeof(int));
+      total += Now() - sent[reply[4]];
+      printf("Best tour of job %d:\n", reply[4]);
+      for (r = 0; r < reply[1]; r++)
+         printf("%d ", cities[r]);
+      printf("\n\nCost = %d\n", reply[0]);
+      if (reply[2] != 0)
+         printf("Stopped early (%s):  lower bound = %d\n",
+               status_names[reply[2]], reply[3]);
+      else if (reply[3] < reply[0])
+         printf("Not proved optimal:  lower bound = %d\n", reply[3]);
+      free(cities);
+   }
+   if (jobs > 0)
+      fprintf(stderr, "%d jobs, mean %.3f ms from send to reply\n", jobs,
+            1e3 * total / jobs);
+   close(fd);
+   for (i = 0; i < argc - optind - 1; i++)
+      free(job_list[i]);
+   free(job_list);
+   free(sent);
+   return 0;
+}  /* main */
+
+/*------------------------------------------------------------------
+ * Function:  Usage
+ * Purpose:   Inform user how to start program and exit
+ * In arg:    prog_name
+ */
+void Usage(char* prog_name) {
+   fprintf(stderr, "usage: %s [-e <engine>] [-b <bound>] [-p <priority>] "
+         "[-c <CPU budget in ms>] [-r <repeats>] <socket> "
+         "[<matrix file> ...]\n", prog_name);
+   exit(0);
+}  /* Usage */
+
+/*------------------------------------------------------------------
+ * Function:  Lookup
+ * Purpose:   Find name in names
+ * Ret val:   Its index, or -1
+ */
+int Lookup(const char* names[], int count, char* name) {
+   int i;
+
+   for (i = 0; i < count; i++)
+      if (strcmp(names[i], name) == 0)
+         return i;
+   return -1;
+}  /* Lookup */
+
+/*------------------------------------------------------------------
+ * Function:  Read_job
+ * Purpose:   Read a matrix file into the wire format of a job
+ * Ret val:   The job:  n, engine, bound, priority, budget, an id
+ *            filled in when it is sent, then the costs
+ */
+int* Read_job(char* file_name, int engine, int bound, int priority,
+      int budget) {
+   FILE* mat_file = fopen(file_name, "r");
+   int n, i;
+   int* job;
+
+   if (mat_file == NULL || fscanf(mat_file, "%d", &n) != 1 || n < 1) {
+      fprintf(stderr, "Can't read %s\n", file_name);
+      exit(1);
+   }
+   job = malloc((6 + n * n) * sizeof(int));
+   job[0] = n;
+   job[1] = engine;
+   job[2] = bound;
+   job[3] = priority;
+   job[4] = budget;
+   job[5] = 0;
+   for (i = 0; i < n * n; i++)
+      fscanf(mat_file, "%d", &job[6 + i]);
+   fclose(mat_file);
+   return job;
+}  /* Read_job */
+
+/*------------------------------------------------------------------
+ * Function:  Read_all
+ * Purpose:   Read exactly bytes bytes from fd
+ * Ret val:   0 at the end of the stream or on an error, 1 otherwise
+ */
+int Read_all(int fd, void* buf, size_t bytes) {
+   ssize_t got;
+
+   while (bytes > 0) {
+      got = read(fd, buf, bytes);
+      if (got <= 0)
+         return 0;
+      buf = (char*) buf + got;
+      bytes -= got;
+   }
+   return 1;
+}  /* Read_all */
+
+/*------------------------------------------------------------------
+ * Function:  Write_all
+ * Purpose:   Write all of buf to fd
+ * Ret val:   0 on an error, 1 otherwise
+ */
+int Write_all(int fd, const void* buf, size_t bytes) {
+   ssize_t put;
+
+   while (bytes > 0) {
+      put = write(fd, buf, bytes);
+      if (put <= 0)
+         return 0;
+      buf = (const char*) buf + put;
+      bytes -= put;
+   }
+   return 1;
+}  /* Write_all */
+
+/*------------------------------------------------------------------
+ * Function:  Now
+ * Purpose:   Seconds on the monotonic clock
+ */
+double Now(void) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec + 1e-9 * now.tv_nsec;
+}  /* Now */
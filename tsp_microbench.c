@@ -0,0 +1,462 @@
+/* File:     tsp_microbench.c
+ * Purpose:  Time the primitives of pth_tsp_search_nr's DFS one at a
+ *           time, so changes to them can be judged apart from the shape
+ *           of any one search tree.
+ * Output:   One line per case:  primitive n size threads ns/op
+ * Compile:  gcc -O2 -Wall -o tsp_microbench tsp_microbench.c -lpthread -lm
+ *           with pth_tsp_search_nr_part2.c in the same directory
+ * Usage:    tsp_microbench [-t <max threads>] [<n> ...]
+ *           max threads is 64 by default; the sizes of n default to
+ *           10 20 50 100 200
+ *
+ * Notes:
+ * 1.  The solver is included with NO_MAIN (note 29 of
+ *     pth_tsp_search_nr_part2.c), so the functions timed are the ones
+ *     the solver runs, with the same globals.
+ * 2.  The matrix is random, with costs 1 to 100, and the tour given to
+ *     Push, Dup_tour, Visited and Feasible holds n / 2 cities, as at
+ *     the middle of the search tree.
+ * 3.  size is the number of records on the stack:  Push and Pop fill
+ *     and empty a stack of that size, and Split_stack splits one.
+ *     Only the primitive itself is timed, not building or freeing
+ *     what it works on.  Split_stack doesn't depend on n.
+ * 4.  Check_best_tour and Split_stack are also run by 1, 2, 4, ...,
+ *     max threads at once.  Check_best_tour is timed both when the
+ *     tours never beat best_tour (its read lock only) and when nearly
+ *     every call does (improve).  Split_stack is called under
+ *     term_mutex, as Terminated calls it.  ns/op is the mean time of
+ *     a call as seen by the thread making it.
+ * 5.  Each case is repeated, doubling the repetitions, until it takes
+ *     at least BENCH_SECONDS.
+ */
+#define NO_MAIN
+#include "pth_tsp_search_nr_part2.c"
+#include <limits.h>
+
+const double BENCH_SECONDS = 0.05;
+const int BENCH_MAX_COST = 100;
+#define BENCH_SIZES 3
+
+typedef struct {
+	long rank;
+	int threads;
+	int size; /* Stack records, where it applies */
+	long reps;
+	double seconds; /* Time spent in the primitive */
+	double ops; /* Calls of the primitive */
+} bench_arg_t;
+
+const int stack_sizes[BENCH_SIZES] = { 16, 256, 4096 };
+tour_t bench_tour; /* Half a tour, for Push, Dup_tour, Visited and Feasible */
+pthread_barrier_t bench_barrier;
+volatile long bench_sink; /* Keeps results from being optimized away */
+
+void Bench_usage(char* prog_name);
+void Setup_bench(int size);
+void Free_bench(void);
+void Run_case(const char* name, void *(*fn)(void*), int threads, int size);
+double Run_threads(void *(*fn)(void*), int threads, int size, long reps,
+		double* per_op_p);
+void *Bench_push(void* arg);
+void *Bench_pop(void* arg);
+void *Bench_dup_tour(void* arg);
+void *Bench_visited(void* arg);
+void *Bench_feasible(void* arg);
+void *Bench_check_read(void* arg);
+void *Bench_check_improve(void* arg);
+void *Bench_split_stack(void* arg);
+
+/*------------------------------------------------------------------*/
+int main(int argc, char* argv[]) {
+	int default_sizes[] = { 10, 20, 50, 100, 200 };
+	int* sizes = default_sizes;
+	int size_count = 5, max_threads = 64, opt, i, s, t;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		if (opt == 't')
+			max_threads = strtol(optarg, NULL, 10);
+		else
+			Bench_usage(argv[0]);
+	}
+	if (max_threads < 1)
+		Bench_usage(argv[0]);
+	if (optind < argc) {
+		size_count = argc - optind;
+		sizes = malloc(size_count * sizeof(int));
+		for (i = 0; i < size_count; i++) {
+			sizes[i] = strtol(argv[optind + i], NULL, 10);
+			if (sizes[i] < 4)
+				Bench_usage(argv[0]);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &solve_start);
+	pthread_rwlock_init(&best_tour_lock, NULL);
+	pthread_mutex_init(&term_mutex, NULL);
+	srandom(1);
+
+	printf("primitive n size threads ns/op\n");
+	for (i = 0; i < size_count; i++) {
+		Setup_bench(sizes[i]);
+		for (s = 0; s < BENCH_SIZES; s++)
+			Run_case("Push", Bench_push, 1, stack_sizes[s]);
+		for (s = 0; s < BENCH_SIZES; s++)
+			Run_case("Pop", Bench_pop, 1, stack_sizes[s]);
+		Run_case("Dup_tour", Bench_dup_tour, 1, 0);
+		Run_case("Visited", Bench_visited, 1, 0);
+		Run_case("Feasible", Bench_feasible, 1, 0);
+		for (t = 1; t <= max_threads; t *= 2)
+			Run_case("Check_best_tour", Bench_check_read, t, 0);
+		for (t = 1; t <= max_threads; t *= 2)
+			Run_case("Check_best_tour/improve", Bench_check_improve, t, 0);
+		Free_bench();
+	}
+	n = 0; /* Split_stack doesn't look at the tours */
+	for (s = 0; s < BENCH_SIZES; s++)
+		for (t = 1; t <= max_threads; t *= 2)
+			Run_case("Split_stack", Bench_split_stack, t, stack_sizes[s]);
+
+	pthread_mutex_destroy(&term_mutex);
+	pthread_rwlock_destroy(&best_tour_lock);
+	if (sizes != default_sizes)
+		free(sizes);
+	return 0;
+} /* main */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_usage
+ * Purpose:   Inform user how to start program and exit
+ * In arg:    prog_name
+ */
+void Bench_usage(char* prog_name) {
+	fprintf(stderr, "usage: %s [-t <max threads>] [<n> ...]\n", prog_name);
+	fprintf(stderr, "n is at least 4\n");
+	exit(0);
+} /* Bench_usage */
+
+/*------------------------------------------------------------------
+ * Function:         Setup_bench
+ * Purpose:          Make a random instance of size cities, and the half
+ *                   tour through it that the primitives work on
+ * In arg:           size
+ * Global vars out:  n, mat, best_tour, bench_tour
+ */
+void Setup_bench(int size) {
+	city_t* perm;
+	city_t j, k;
+	int i;
+
+	n = size;
+	mat = malloc(n * n * sizeof(weight_t));
+	for (i = 0; i < n * n; i++)
+		mat[i] = i / n == i % n ? 0 : 1 + random() % BENCH_MAX_COST;
+	Initialize_tour(&best_tour);
+
+	/* A random order of the cities other than 0 */
+	perm = malloc(n * sizeof(city_t));
+	for (i = 0; i < n; i++)
+		perm[i] = i;
+	for (i = n - 1; i > 1; i--) {
+		j = 1 + random() % i;
+		k = perm[i];
+		perm[i] = perm[j];
+		perm[j] = k;
+	}
+	Initialize_tour(&bench_tour);
+	for (i = 0; i < n / 2; i++) {
+		bench_tour.cities[i] = perm[i];
+		if (i > 0)
+			bench_tour.cost += mat[n * perm[i - 1] + perm[i]];
+	}
+	bench_tour.count = n / 2;
+	free(perm);
+} /* Setup_bench */
+
+/*------------------------------------------------------------------
+ * Function:  Free_bench
+ * Purpose:   Free what Setup_bench allocated
+ */
+void Free_bench(void) {
+	free(bench_tour.cities);
+	free(best_tour.cities);
+	free(mat);
+} /* Free_bench */
+
+/*------------------------------------------------------------------
+ * Function:  Run_case
+ * Purpose:   Run fn on threads threads with twice as many repetitions
+ *            each time until a run takes BENCH_SECONDS, and print the
+ *            time per call of the last run
+ * In args:   All
+ */
+void Run_case(const char* name, void *(*fn)(void*), int threads, int size) {
+	long reps = 1;
+	double per_op;
+
+	while (Run_threads(fn, threads, size, reps, &per_op) < BENCH_SECONDS)
+		reps *= 2;
+	if (n > 0)
+		printf("%s %d ", name, n);
+	else
+		printf("%s - ", name);
+	if (size > 0)
+		printf("%d ", size);
+	else
+		printf("- ");
+	printf("%d %.1f\n", threads, 1e9 * per_op);
+	fflush(stdout);
+} /* Run_case */
+
+/*------------------------------------------------------------------
+ * Function:  Run_threads
+ * Purpose:   Run fn on threads threads, each making reps repetitions
+ * In args:   fn, threads, size, reps
+ * Out arg:   per_op_p:  the mean seconds per call over all threads
+ * Ret val:   The seconds the whole run took
+ */
+double Run_threads(void *(*fn)(void*), int threads, int size, long reps,
+		double* per_op_p) {
+	pthread_t* handles = malloc(threads * sizeof(pthread_t));
+	bench_arg_t* args = malloc(threads * sizeof(bench_arg_t));
+	double start, seconds = 0.0, ops = 0.0;
+	long t;
+
+	pthread_barrier_init(&bench_barrier, NULL, threads);
+	start = Elapsed();
+	for (t = 0; t < threads; t++) {
+		args[t].rank = t;
+		args[t].threads = threads;
+		args[t].size = size;
+		args[t].reps = reps;
+		args[t].seconds = 0.0;
+		args[t].ops = 0.0;
+		pthread_create(&handles[t], NULL, fn, &args[t]);
+	}
+	for (t = 0; t < threads; t++) {
+		pthread_join(handles[t], NULL);
+		seconds += args[t].seconds;
+		ops += args[t].ops;
+	}
+	pthread_barrier_destroy(&bench_barrier);
+	*per_op_p = seconds / ops;
+	free(args);
+	free(handles);
+	return Elapsed() - start;
+} /* Run_threads */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_push
+ * Purpose:   Push size records onto an empty stack, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_push(void* arg) {
+	bench_arg_t* arg_p = arg;
+	stack_elt_t* stack_p = NULL;
+	double start;
+	long r;
+	int i;
+
+	for (r = 0; r < arg_p->reps; r++) {
+		start = Elapsed();
+		for (i = 0; i < arg_p->size; i++)
+			Push(&bench_tour, i % n, 1, &stack_p);
+		arg_p->seconds += Elapsed() - start;
+		Free_stack(stack_p);
+		stack_p = NULL;
+	}
+	arg_p->ops = (double) arg_p->reps * arg_p->size;
+	return NULL;
+} /* Bench_push */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_pop
+ * Purpose:   Pop a stack of size records until it is empty, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_pop(void* arg) {
+	bench_arg_t* arg_p = arg;
+	stack_elt_t* stack_p = NULL;
+	tour_t** tours = malloc(arg_p->size * sizeof(tour_t*));
+	city_t city;
+	weight_t cost;
+	double start;
+	long r;
+	int i;
+
+	for (r = 0; r < arg_p->reps; r++) {
+		for (i = 0; i < arg_p->size; i++)
+			Push(&bench_tour, i % n, 1, &stack_p);
+		start = Elapsed();
+		for (i = 0; i < arg_p->size; i++)
+			Pop(&tours[i], &city, &cost, &stack_p);
+		arg_p->seconds += Elapsed() - start;
+		for (i = 0; i < arg_p->size; i++) {
+			free(tours[i]->cities);
+			free(tours[i]);
+		}
+	}
+	arg_p->ops = (double) arg_p->reps * arg_p->size;
+	free(tours);
+	return NULL;
+} /* Bench_pop */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_dup_tour
+ * Purpose:   Duplicate bench_tour 256 times, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_dup_tour(void* arg) {
+	bench_arg_t* arg_p = arg;
+	tour_t* tours[256];
+	double start;
+	long r;
+	int i;
+
+	for (r = 0; r < arg_p->reps; r++) {
+		start = Elapsed();
+		for (i = 0; i < 256; i++)
+			tours[i] = Dup_tour(&bench_tour);
+		arg_p->seconds += Elapsed() - start;
+		for (i = 0; i < 256; i++) {
+			free(tours[i]->cities);
+			free(tours[i]);
+		}
+	}
+	arg_p->ops = 256.0 * arg_p->reps;
+	return NULL;
+} /* Bench_dup_tour */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_visited
+ * Purpose:   Ask whether each city is on bench_tour, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_visited(void* arg) {
+	bench_arg_t* arg_p = arg;
+	double start = Elapsed();
+	long r, hits = 0;
+	city_t nbr;
+
+	for (r = 0; r < arg_p->reps; r++)
+		for (nbr = 0; nbr < n; nbr++)
+			hits += Visited(nbr, &bench_tour);
+	arg_p->seconds = Elapsed() - start;
+	arg_p->ops = (double) arg_p->reps * n;
+	bench_sink += hits;
+	return NULL;
+} /* Bench_visited */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_feasible
+ * Purpose:   Ask whether each city could extend bench_tour, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_feasible(void* arg) {
+	bench_arg_t* arg_p = arg;
+	city_t city = bench_tour.cities[bench_tour.count - 1], nbr;
+	weight_t lower = Lower_bound(&bench_tour);
+	double start = Elapsed();
+	long r, hits = 0;
+
+	/* Half the costs of an edge pass the incumbent, half don't */
+	for (r = 0; r < arg_p->reps; r++)
+		for (nbr = 0; nbr < n; nbr++)
+			hits += Feasible(city, nbr, &bench_tour, lower,
+					lower + BENCH_MAX_COST / 2);
+	arg_p->seconds = Elapsed() - start;
+	arg_p->ops = (double) arg_p->reps * n;
+	bench_sink += hits;
+	return NULL;
+} /* Bench_feasible */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_check_read
+ * Purpose:   Offer best_tour a complete tour that never beats it, 256
+ *            times per repetition
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_check_read(void* arg) {
+	bench_arg_t* arg_p = arg;
+	tour_t* tour_p = Dup_tour(&bench_tour);
+	int l_best_tour, i;
+	double start;
+	long r;
+
+	tour_p->count = n;
+	tour_p->cost = INFINITY;
+	if (arg_p->rank == 0)
+		best_tour.cost = 0;
+	pthread_barrier_wait(&bench_barrier);
+	start = Elapsed();
+	for (r = 0; r < arg_p->reps; r++)
+		for (i = 0; i < 256; i++)
+			Check_best_tour(i % n, tour_p, &l_best_tour, NULL);
+	arg_p->seconds = Elapsed() - start;
+	arg_p->ops = 256.0 * arg_p->reps;
+	free(tour_p->cities);
+	free(tour_p);
+	return NULL;
+} /* Bench_check_read */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_check_improve
+ * Purpose:   Offer best_tour complete tours that get cheaper with each
+ *            call, 256 times per repetition, so nearly every call takes
+ *            the write lock
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_check_improve(void* arg) {
+	bench_arg_t* arg_p = arg;
+	tour_t* tour_p = Dup_tour(&bench_tour);
+	int l_best_tour, i;
+	double start;
+	long r;
+
+	tour_p->count = n;
+	tour_p->cost = INT_MAX / 2 - BENCH_MAX_COST - arg_p->rank;
+	if (arg_p->rank == 0)
+		best_tour.cost = INT_MAX / 2;
+	pthread_barrier_wait(&bench_barrier);
+	start = Elapsed();
+	for (r = 0; r < arg_p->reps; r++)
+		for (i = 0; i < 256; i++) {
+			Check_best_tour(0, tour_p, &l_best_tour, NULL);
+			tour_p->cost -= arg_p->threads;
+		}
+	arg_p->seconds = Elapsed() - start;
+	arg_p->ops = 256.0 * arg_p->reps;
+	free(tour_p->cities);
+	free(tour_p);
+	return NULL;
+} /* Bench_check_improve */
+
+/*------------------------------------------------------------------
+ * Function:  Bench_split_stack
+ * Purpose:   Split a stack of size records under term_mutex, as
+ *            Terminated does, reps times
+ * In/out arg:arg:  a bench_arg_t
+ */
+void *Bench_split_stack(void* arg) {
+	bench_arg_t* arg_p = arg;
+	stack_elt_t* records = malloc(arg_p->size * sizeof(stack_elt_t));
+	int my_size, i;
+	double start;
+	long r;
+
+	pthread_barrier_wait(&bench_barrier);
+	for (r = 0; r < arg_p->reps; r++) {
+		for (i = 0; i < arg_p->size; i++)
+			records[i].next_p = i + 1 < arg_p->size ? &records[i + 1] : NULL;
+		my_size = arg_p->size;
+		start = Elapsed();
+		pthread_mutex_lock(&term_mutex);
+		Split_stack(records, &my_size, arg_p->rank);
+		new_stack = NULL; /* Taken straight back */
+		new_stack_size = 0;
+		pthread_mutex_unlock(&term_mutex);
+		arg_p->seconds += Elapsed() - start;
+	}
+	arg_p->ops = arg_p->reps;
+	free(records);
+	return NULL;
+} /* Bench_split_stack */